@@ -42,6 +42,9 @@ ssd_start()
 		output_logger_arg="--stdout-logger \"$output_logger\""
 	[ -n "$error_logger" ] && 
 		error_logger_arg="--stderr-logger \"$error_logger\""
+	# Have the daemon started straight into the cgroup rc-cgroup.sh made
+	local _cgroup=
+	[ -d "${rc_cgroup_path}" ] && _cgroup="--cgroup ${rc_cgroup_path}"
 	#the eval call is necessary for cases like:
 	# command_args="this \"is a\" test"
 	# to work properly.
@@ -57,6 +60,9 @@ ssd_start()
 		${pidfile:+--pidfile} $pidfile \
 		${command_user+--user} $command_user \
 		${umask+--umask} $umask \
+		${notify:+--notify} $notify \
+		${notify_timeout:+--notify-timeout} $notify_timeout \
+		${_cgroup} \
 		$_background $start_stop_daemon_args \
 		-- $command_args $command_args_background
 	if eend $? "Failed to start ${name:-$RC_SVCNAME}"; then
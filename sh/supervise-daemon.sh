@@ -19,6 +19,9 @@ supervise_start()
 	fi
 
 	ebegin "Starting ${name:-$RC_SVCNAME}"
+	# Have the daemon started straight into the cgroup rc-cgroup.sh made
+	local _cgroup=
+	[ -d "${rc_cgroup_path}" ] && _cgroup="--cgroup ${rc_cgroup_path}"
 	# The eval call is necessary for cases like:
 	# command_args="this \"is a\" test"
 	# to work properly.
@@ -34,6 +37,9 @@ supervise_start()
 		${respawn_period:+--respawn-period} $respawn_period \
 		${command_user+--user} $command_user \
 		${umask+--umask} $umask \
+		${notify:+--notify} $notify \
+		${notify_timeout:+--notify-timeout} $notify_timeout \
+		${_cgroup} \
 		${supervise_daemon_args:-${start_stop_daemon_args}} \
 		$command \
 		-- $command_args $command_args_foreground
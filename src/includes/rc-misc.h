@@ -33,9 +33,14 @@
 
 #define RC_DEPTREE_CACHE        RC_SVCDIR "/deptree"
 #define RC_DEPTREE_SKEWED	RC_SVCDIR "/clock-skewed"
+#define RC_DEPTREE_SERVICES	RC_SVCDIR "/deptree.d"
 #define RC_KRUNLEVEL            RC_SVCDIR "/krunlevel"
 #define RC_STARTING             RC_SVCDIR "/rc.starting"
 #define RC_STOPPING             RC_SVCDIR "/rc.stopping"
+#define RC_READAHEAD_TRACE      RC_SVCDIR "/readahead.trace"
+
+#define RC_HISTORY_DIR		RC_PREFIX "/var/lib/openrc"
+#define RC_STOP_HISTORY		RC_HISTORY_DIR "/stops"
 
 #define RC_SVCDIR_STARTING      RC_SVCDIR "/starting"
 #define RC_SVCDIR_INACTIVE      RC_SVCDIR "/inactive"
@@ -65,10 +70,15 @@ int parse_mode(mode_t *, char *);
 
 /* Handy function so we can wrap einfo around our deptree */
 RC_DEPTREE *_rc_deptree_load (int, int *);
+RC_DEPTREE *_rc_deptree_load_service(const char *);
 
 RC_SERVICE lookup_service_state(const char *service);
 void from_time_t(char *time_string, time_t tv);
 time_t to_time_t(char *timestring);
 pid_t get_pid(const char *applet, const char *pidfile);
+pid_t get_pid_wait(const char *applet, const char *pidfile, int timeout,
+    pid_t child);
+bool pid_alive_for(pid_t pid, int timeout, bool child);
+void close_fds(int first, int last, bool cloexec);
 
 #endif
@@ -0,0 +1,305 @@
+/*
+ * librc-cgroup.c
+ * Place services in cgroup2 groups
+ */
+
+/*
+ * Copyright (c) 2007-2015 The OpenRC Authors.
+ * See the Authors file at the top-level directory of this distribution and
+ * https://github.com/OpenRC/openrc/blob/master/AUTHORS
+ *
+ * This file is part of OpenRC. It is subject to the license terms in
+ * the LICENSE file found in the top-level directory of this
+ * distribution and at https://github.com/OpenRC/openrc/blob/master/LICENSE
+ * This file may not be copied, modified, propagated, or distributed
+ *    except according to the terms contained in the LICENSE file.
+ */
+
+#ifdef __linux__
+#  include <sys/syscall.h>
+#  include <stdint.h>
+#  include <linux/sched.h>
+#endif
+
+#include <poll.h>
+
+#include "queue.h"
+#include "librc.h"
+#include "helpers.h"
+
+#if defined(SYS_clone3) && defined(CLONE_INTO_CGROUP)
+#  define HAVE_CLONE3
+#endif
+
+static bool
+cgroup2_supported(void)
+{
+	FILE *fp;
+	char *line = NULL, *p;
+	size_t len = 0;
+	bool found = false;
+
+	if (!(fp = fopen("/proc/filesystems", "r")))
+		return false;
+	while (!found && getline(&line, &len, fp) != -1) {
+		line[strcspn(line, "\n")] = '\0';
+		p = strrchr(line, '\t');
+		found = strcmp(p ? p + 1 : line, "cgroup2") == 0;
+	}
+	free(line);
+	fclose(fp);
+	return found;
+}
+
+char *
+rc_cgroup_dir(const char *service, const char *mode)
+{
+	const char *root;
+	char *dir;
+	struct stat st;
+
+	if (!mode || !*mode || strcmp(mode, "hybrid") == 0)
+		root = "/sys/fs/cgroup/unified";
+	else if (strcmp(mode, "unified") == 0)
+		root = "/sys/fs/cgroup";
+	else
+		return NULL;
+	if (!cgroup2_supported() ||
+	    stat(root, &st) != 0 || !S_ISDIR(st.st_mode))
+		return NULL;
+	xasprintf(&dir, "%s/%s", root, service);
+	return dir;
+}
+librc_hidden_def(rc_cgroup_dir)
+
+/* Write one value, as a single write so the kernel sees all of it */
+static bool
+cgroup_write(int dirfd, const char *file, const char *value)
+{
+	char *buf;
+	int fd;
+	ssize_t len, r;
+
+	if ((fd = openat(dirfd, file, O_WRONLY | O_CLOEXEC)) == -1)
+		return false;
+	len = xasprintf(&buf, "%s\n", value);
+	r = write(fd, buf, len);
+	free(buf);
+	close(fd);
+	return r == len;
+}
+
+bool
+rc_cgroup_set(int dirfd, const char *settings)
+{
+	char *copy, *p, *line, *key, *value;
+	bool retval = true;
+
+	if (!settings)
+		return true;
+	p = copy = xstrdup(settings);
+	while ((line = strsep(&p, "\n"))) {
+		key = line + strspn(line, " \t");
+		value = key + strcspn(key, " \t");
+		if (*value)
+			*value++ = '\0';
+		value += strspn(value, " \t");
+		if (!*key || !*value)
+			continue;
+		/* Like the shell, ignore controllers this group lacks */
+		if (!cgroup_write(dirfd, key, value) && errno != ENOENT)
+			retval = false;
+	}
+	free(copy);
+	return retval;
+}
+librc_hidden_def(rc_cgroup_set)
+
+int
+rc_cgroup_open(const char *dir, const char *settings)
+{
+	int fd;
+
+	if (mkdir(dir, 0755) == -1 && errno != EEXIST)
+		return -1;
+	if ((fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) == -1)
+		return -1;
+	rc_cgroup_set(fd, settings);
+	return fd;
+}
+librc_hidden_def(rc_cgroup_open)
+
+pid_t
+rc_cgroup_fork(int dirfd)
+{
+	pid_t pid;
+#ifdef HAVE_CLONE3
+	struct clone_args args;
+
+	if (dirfd >= 0) {
+		memset(&args, 0, sizeof(args));
+		args.flags = CLONE_INTO_CGROUP;
+		args.exit_signal = SIGCHLD;
+		args.cgroup = (uint64_t)dirfd;
+		pid = syscall(SYS_clone3, &args, sizeof(args));
+		if (pid != -1 || (errno != ENOSYS && errno != E2BIG &&
+		    errno != EINVAL && errno != EOPNOTSUPP))
+			return pid;
+	}
+#endif
+
+	/* The kernel cannot do it for us, so the child moves itself */
+	if ((pid = fork()) == 0 && dirfd >= 0)
+		cgroup_write(dirfd, "cgroup.procs", "0");
+	return pid;
+}
+librc_hidden_def(rc_cgroup_fork)
+
+bool
+rc_cgroup_remove(const char *dir)
+{
+	switch (rc_cgroup_populated(dir)) {
+	case -1:
+		return errno == ENOENT;
+	case 0:
+		return rmdir(dir) == 0 || errno == ENOENT;
+	default:
+		return false;
+	}
+}
+librc_hidden_def(rc_cgroup_remove)
+
+/* Read populated from an open cgroup.events */
+static int
+cgroup_populated(FILE *fp)
+{
+	char *line = NULL;
+	size_t len = 0;
+	int populated = -1;
+
+	rewind(fp);
+	while (getline(&line, &len, fp) != -1)
+		sscanf(line, "populated %d", &populated);
+	free(line);
+	return populated;
+}
+
+int
+rc_cgroup_populated(const char *dir)
+{
+	FILE *fp;
+	char *events;
+	int populated;
+
+	xasprintf(&events, "%s/cgroup.events", dir);
+	fp = fopen(events, "re");
+	free(events);
+	if (!fp)
+		return -1;
+	populated = cgroup_populated(fp);
+	fclose(fp);
+	return populated;
+}
+librc_hidden_def(rc_cgroup_populated)
+
+static RC_PIDLIST *
+cgroup_pids(const char *dir)
+{
+	FILE *fp;
+	char *procs, *line = NULL;
+	size_t len = 0;
+	RC_PIDLIST *pids;
+	RC_PID *pi;
+	pid_t pid;
+
+	xasprintf(&procs, "%s/cgroup.procs", dir);
+	fp = fopen(procs, "re");
+	free(procs);
+	if (!fp)
+		return NULL;
+	pids = xmalloc(sizeof(*pids));
+	LIST_INIT(pids);
+	while (getline(&line, &len, fp) != -1) {
+		if (sscanf(line, "%d", &pid) != 1 || pid == getpid())
+			continue;
+		pi = xmalloc(sizeof(*pi));
+		pi->pid = pid;
+		LIST_INSERT_HEAD(pids, pi, entries);
+	}
+	free(line);
+	fclose(fp);
+	return pids;
+}
+
+int
+rc_cgroup_kill(const char *dir, int sig)
+{
+	RC_PIDLIST *pids;
+	RC_PID *pi, *np;
+	int dirfd, n = 0;
+	bool killed = false;
+
+	if (!(pids = cgroup_pids(dir)))
+		return -1;
+	LIST_FOREACH(pi, pids, entries)
+		n++;
+
+	/* cgroup.kill also gets anything forked while we look */
+	if (n && sig == SIGKILL &&
+	    (dirfd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) != -1)
+	{
+		killed = cgroup_write(dirfd, "cgroup.kill", "1");
+		close(dirfd);
+	}
+
+	LIST_FOREACH_SAFE(pi, pids, entries, np) {
+		if (!killed && sig != 0 &&
+		    kill(pi->pid, sig) == -1 && errno != ESRCH)
+			n = -1;
+		/* A stopped process would never see the signal */
+		else if (sig != 0 && sig != SIGKILL && sig != SIGCONT)
+			kill(pi->pid, SIGCONT);
+		free(pi);
+	}
+	free(pids);
+	return n;
+}
+librc_hidden_def(rc_cgroup_kill)
+
+bool
+rc_cgroup_wait(const char *dir, int timeout)
+{
+	FILE *fp;
+	char *events;
+	struct pollfd pfd;
+	struct timespec now, end;
+	int populated, ms;
+
+	xasprintf(&events, "%s/cgroup.events", dir);
+	fp = fopen(events, "re");
+	free(events);
+	if (!fp)
+		return errno == ENOENT;
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	end.tv_sec += timeout / 1000;
+	end.tv_nsec += (timeout % 1000) * 1000000L;
+	if (end.tv_nsec >= 1000000000L) {
+		end.tv_sec++;
+		end.tv_nsec -= 1000000000L;
+	}
+
+	/* The kernel flags cgroup.events when populated changes */
+	pfd.fd = fileno(fp);
+	pfd.events = POLLPRI;
+	while ((populated = cgroup_populated(fp)) == 1) {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		ms = (end.tv_sec - now.tv_sec) * 1000 +
+		    (end.tv_nsec - now.tv_nsec) / 1000000L;
+		if (ms <= 0 || (poll(&pfd, 1, ms) == -1 && errno != EINTR))
+			break;
+	}
+	fclose(fp);
+	return populated != 1;
+}
+librc_hidden_def(rc_cgroup_wait)
@@ -18,197 +18,279 @@
 #include "queue.h"
 #include "librc.h"
 
-#if defined(__linux__) || (defined (__FreeBSD_kernel__) && defined(__GLIBC__)) \
-	|| defined(__GNU__)
-static bool
-pid_is_exec(pid_t pid, const char *exec)
+/* What rc_find_pids is looking for, so a snapshot taken for it can
+ * skip everything else as cheaply as possible */
+struct proc_query {
+	const char *exec;
+	const char *const *argv;
+	uid_t uid;
+	pid_t pid;
+};
+
+static RC_PROCS *
+procs_new(void)
 {
-	char *buffer = NULL;
-	FILE *fp;
-	int c;
-	bool retval = false;
+	RC_PROCS *procs = xmalloc(sizeof(*procs));
+	char *pp;
 
-	exec = basename_c(exec);
-	xasprintf(&buffer, "/proc/%d/stat", pid);
-	if ((fp = fopen(buffer, "r"))) {
-		while ((c = getc(fp)) != EOF && c != '(')
-			;
-		if (c == '(') {
-			while ((c = getc(fp)) != EOF && c == *exec)
-				exec++;
-			if (c == ')' && *exec == '\0')
-				retval = true;
-		}
-		fclose(fp);
+	memset(procs, 0, sizeof(*procs));
+
+	/*
+	  We never match RC_OPENRC_PID if present so we avoid the below
+	  scenario
+
+	  /etc/init.d/ntpd stop does
+	  start-stop-daemon --stop --name ntpd
+	  catching /etc/init.d/ntpd stop
+
+	  nasty
+	*/
+
+	if ((pp = getenv("RC_OPENRC_PID"))) {
+		if (sscanf(pp, "%d", &procs->openrc_pid) != 1)
+			procs->openrc_pid = 0;
 	}
-	free(buffer);
-	return retval;
+	return procs;
 }
 
-static bool
-pid_is_argv(pid_t pid, const char *const *argv)
+static void
+procs_add(RC_PROCS *procs, const RC_PROC *proc, const char *cmdline,
+    size_t len)
 {
-	char *cmdline = NULL;
-	int fd;
-	char buffer[PATH_MAX];
-	char *p;
-	ssize_t bytes;
+	RC_PROC *p;
 
-	xasprintf(&cmdline, "/proc/%u/cmdline", pid);
-	if ((fd = open(cmdline, O_RDONLY)) < 0) {
-		free(cmdline);
-		return false;
+	if (procs->count == procs->size) {
+		procs->size = procs->size ? procs->size * 2 : 256;
+		procs->procs = xrealloc(procs->procs,
+		    sizeof(*procs->procs) * procs->size);
 	}
-	bytes = read(fd, buffer, sizeof(buffer));
-	close(fd);
-	free(cmdline);
-	if (bytes == -1)
-		return false;
+	p = &procs->procs[procs->count++];
+	*p = *proc;
+	p->cmdline = xmalloc(len + 1);
+	memcpy(p->cmdline, cmdline, len);
+	p->cmdline[len] = '\0';
+	p->cmdline_len = len;
+}
+
+static int
+proc_cmp(const void *a, const void *b)
+{
+	const RC_PROC *pa = a;
+	const RC_PROC *pb = b;
+
+	return (pa->pid > pb->pid) - (pa->pid < pb->pid);
+}
+
+static bool
+argv_match(const char *cmdline, size_t len, const char *const *argv)
+{
+	const char *p = cmdline;
 
-	buffer[bytes] = '\0';
-	p = buffer;
 	while (*argv) {
-		if (strcmp(*argv, p) != 0)
+		if (p >= cmdline + len || strcmp(*argv, p) != 0)
 			return false;
 		argv++;
 		p += strlen(p) + 1;
-		if ((unsigned)(p - buffer) > sizeof(buffer))
-			return false;
 	}
 	return true;
 }
 
-RC_PIDLIST *
-rc_find_pids(const char *exec, const char *const *argv, uid_t uid, pid_t pid)
+#if defined(__linux__) || (defined (__FreeBSD_kernel__) && defined(__GLIBC__)) \
+	|| defined(__GNU__)
+/* Read a file under /proc/<pid> into buf without touching the heap.
+ * Returns the number of bytes read, or -1. */
+static ssize_t
+proc_read(int procfd, const char *pid, const char *file,
+    char *buf, size_t len)
 {
-	DIR *procdir;
-	struct dirent *entry;
-	FILE *fp;
-	int rc;
-	bool container_pid = false;
-	bool openvz_host = false;
-	char *line = NULL;
-	char my_ns[30];
-	char proc_ns[30];
-	size_t len = 0;
-	pid_t p;
-	char *buffer = NULL;
+	char path[PATH_MAX];
+	ssize_t bytes;
+	int fd;
+
+	snprintf(path, sizeof(path), "%s/%s", pid, file);
+	if ((fd = openat(procfd, path, O_RDONLY | O_CLOEXEC)) == -1)
+		return -1;
+	bytes = read(fd, buf, len - 1);
+	close(fd);
+	if (bytes == -1)
+		return -1;
+	buf[bytes] = '\0';
+	return bytes;
+}
+
+/* comm and ppid from /proc/<pid>/stat. comm is in brackets and may
+ * hold anything, including brackets, so look for the last one. */
+static bool
+pid_stat(int procfd, const char *pid, RC_PROC *proc)
+{
+	char buffer[512];
+	char *start, *end;
+
+	if (proc_read(procfd, pid, "stat", buffer, sizeof(buffer)) <= 0 ||
+	    (start = strchr(buffer, '(')) == NULL ||
+	    (end = strrchr(start, ')')) == NULL)
+		return false;
+	*end = '\0';
+	snprintf(proc->comm, sizeof(proc->comm), "%s", start + 1);
+	return sscanf(end + 1, " %*c %d", &proc->ppid) == 1;
+}
+
+static ino_t
+pid_ns(int procfd, const char *pid)
+{
+	char path[PATH_MAX];
 	struct stat sb;
-	pid_t openrc_pid = 0;
-	char *pp;
-	RC_PIDLIST *pids = NULL;
-	RC_PID *pi;
 
-	if ((procdir = opendir("/proc")) == NULL)
-		return NULL;
+	snprintf(path, sizeof(path), "%s/ns/pid", pid);
+	if (fstatat(procfd, path, &sb, 0) != 0)
+		return 0;
+	return sb.st_ino;
+}
 
-	/*
-	  We never match RC_OPENRC_PID if present so we avoid the below
-	  scenario
+/* OpenVZ envID of the pid, or -1 if we are not on OpenVZ */
+static int
+pid_envid(int procfd, const char *pid)
+{
+	char buffer[4096];
+	char *p;
 
-	  /etc/init.d/ntpd stop does
-	  start-stop-daemon --stop --name ntpd
-	  catching /etc/init.d/ntpd stop
+	if (proc_read(procfd, pid, "status", buffer, sizeof(buffer)) == -1 ||
+	    (p = strstr(buffer, "\nenvID:")) == NULL)
+		return -1;
+	return atoi(p + 7);
+}
 
-	  nasty
-	*/
+/*
+ * Rules that tell processes in containers from our own.
+ * init runs once a snapshot and returns false if the rule has nothing to
+ * do on this host. foreign then runs for each pid the query still wants
+ * and returns true if it belongs to a container.
+ * Support for another container host is a new entry in proc_filters.
+ */
+struct proc_filter {
+	bool (*init)(int procfd, RC_PROCS *procs);
+	bool (*foreign)(int procfd, const char *pid, const RC_PROCS *procs,
+	    RC_PROC *proc);
+};
+
+/* The inode of the ns/pid file names the namespace, so one fstatat a pid
+ * is all it takes */
+static bool
+pidns_init(int procfd, RC_PROCS *procs)
+{
+	procs->pidns = pid_ns(procfd, "self");
+	return procs->pidns != 0;
+}
 
-	if ((pp = getenv("RC_OPENRC_PID"))) {
-		if (sscanf(pp, "%d", &openrc_pid) != 1)
-			openrc_pid = 0;
-	}
+static bool
+pidns_foreign(int procfd, const char *pid, const RC_PROCS *procs,
+    RC_PROC *proc)
+{
+	proc->pidns = pid_ns(procfd, pid);
+	return proc->pidns != 0 && proc->pidns != procs->pidns;
+}
 
-	/*
-	If /proc/self/status contains EnvID: 0, then we are an OpenVZ host,
-	and we will need to filter out processes that are inside containers
-	from our list of pids.
-	*/
+/* If /proc/self/status contains envID: 0 then we are an OpenVZ host and
+ * processes with any other envID are inside containers */
+static bool
+openvz_init(int procfd, RC_PROCS *procs _unused)
+{
+	return pid_envid(procfd, "self") == 0;
+}
 
-	if (exists("/proc/self/status")) {
-		fp = fopen("/proc/self/status", "r");
-		if (fp) {
-			while (! feof(fp)) {
-				rc_getline(&line, &len, fp);
-				if (strncmp(line, "envID:\t0", 8) == 0) {
-					openvz_host = true;
-					break;
-				}
-			}
-			fclose(fp);
-		}
-	}
+static bool
+openvz_foreign(int procfd, const char *pid, const RC_PROCS *procs _unused,
+    RC_PROC *proc _unused)
+{
+	return pid_envid(procfd, pid) > 0;
+}
 
-	memset(my_ns, 0, sizeof(my_ns));
-	memset(proc_ns, 0, sizeof(proc_ns));
-	if (exists("/proc/self/ns/pid")) {
-		rc = readlink("/proc/self/ns/pid", my_ns, sizeof(my_ns));
-		if (rc <= 0)
-			my_ns[0] = '\0';
+static const struct proc_filter proc_filters[] = {
+	{ pidns_init, pidns_foreign },
+	{ openvz_init, openvz_foreign },
+};
+
+/* Where procfs is mounted. RC_PROCFS can point us at the mount belonging
+ * to our own pid namespace when /proc is the host's. */
+static int
+procfs_open(void)
+{
+	const char *path = getenv("RC_PROCFS");
+
+	if (!path || !*path)
+		path = "/proc";
+	return open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+}
+
+/* Each pid costs a few openat calls against one /proc fd, with the
+ * cheapest tests for the query first. Nothing is allocated for pids
+ * the query does not want. */
+static RC_PROCS *
+proc_snapshot(const struct proc_query *q)
+{
+	DIR *procdir;
+	struct dirent *entry;
+	int procfd;
+	bool active[ARRAY_SIZE(proc_filters)];
+	size_t i;
+	char cmdline[PATH_MAX];
+	ssize_t len;
+	const char *d;
+	struct stat sb;
+	RC_PROC proc;
+	RC_PROCS *procs;
+
+	if ((procfd = procfs_open()) == -1)
+		return NULL;
+	if ((procdir = fdopendir(procfd)) == NULL) {
+		close(procfd);
+		return NULL;
 	}
+	procs = procs_new();
+	for (i = 0; i < ARRAY_SIZE(proc_filters); i++)
+		active[i] = proc_filters[i].init(procfd, procs);
 
 	while ((entry = readdir(procdir)) != NULL) {
-		if (sscanf(entry->d_name, "%d", &p) != 1)
+		memset(&proc, 0, sizeof(proc));
+		for (d = entry->d_name; *d >= '0' && *d <= '9'; d++)
+			proc.pid = proc.pid * 10 + (*d - '0');
+		if (*d != '\0' || proc.pid == 0)
 			continue;
-		if (openrc_pid != 0 && openrc_pid == p)
+		if (q && ((q->pid != 0 && q->pid != proc.pid) ||
+		    proc.pid == procs->openrc_pid))
 			continue;
-		if (pid != 0 && pid != p)
-			continue;
-		xasprintf(&buffer, "/proc/%d/ns/pid", p);
-		if (exists(buffer)) {
-			rc = readlink(buffer, proc_ns, sizeof(proc_ns));
-			if (rc <= 0)
-				proc_ns[0] = '\0';
-		}
-		free(buffer);
-		if (strlen(my_ns) && strlen (proc_ns) && strcmp(my_ns, proc_ns))
-			continue;
-		if (uid) {
-			xasprintf(&buffer, "/proc/%d", p);
-			if (stat(buffer, &sb) != 0 || sb.st_uid != uid) {
-				free(buffer);
+		if (!q || q->uid) {
+			if (fstatat(procfd, entry->d_name, &sb, 0) != 0)
+				continue;
+			proc.uid = sb.st_uid;
+			if (q && q->uid != proc.uid)
 				continue;
-			}
-			free(buffer);
 		}
-		if (exec && !pid_is_exec(p, exec))
+		if (!pid_stat(procfd, entry->d_name, &proc))
 			continue;
-		if (argv &&
-		    !pid_is_argv(p, (const char *const *)argv))
+		if (q && q->exec && strcmp(proc.comm, q->exec) != 0)
 			continue;
-		/* If this is an OpenVZ host, filter out container processes */
-		if (openvz_host) {
-			xasprintf(&buffer, "/proc/%d/status", p);
-			if (exists(buffer)) {
-				fp = fopen(buffer, "r");
-				free(buffer);
-				if (! fp)
-					continue;
-				while (! feof(fp)) {
-					rc_getline(&line, &len, fp);
-					if (strncmp(line, "envID:", 6) == 0) {
-						container_pid = ! (strncmp(line, "envID:\t0", 8) == 0);
-						break;
-					}
-				}
-				fclose(fp);
+		/* A query never wants a container's processes, so drop them
+		 * before reading their cmdline. A full snapshot flags them. */
+		for (i = 0; i < ARRAY_SIZE(proc_filters); i++)
+			if (active[i] && proc_filters[i].foreign(procfd,
+			    entry->d_name, procs, &proc)) {
+				proc.container = true;
+				break;
 			}
-		}
-		if (container_pid)
+		if (q && proc.container)
 			continue;
-		if (!pids) {
-			pids = xmalloc(sizeof(*pids));
-			LIST_INIT(pids);
-		}
-		pi = xmalloc(sizeof(*pi));
-		pi->pid = p;
-		LIST_INSERT_HEAD(pids, pi, entries);
+		len = proc_read(procfd, entry->d_name, "cmdline",
+		    cmdline, sizeof(cmdline));
+		if (len == -1)
+			len = 0;
+		if (q && q->argv && !argv_match(cmdline, len, q->argv))
+			continue;
+		procs_add(procs, &proc, cmdline, len);
 	}
-	if (line != NULL)
-		free(line);
 	closedir(procdir);
-	return pids;
+	return procs;
 }
-librc_hidden_def(rc_find_pids)
 
 #elif BSD
 
@@ -219,6 +301,7 @@ librc_hidden_def(rc_find_pids)
 #  define _GET_KINFO_UID(kp) (kp.p_ruid)
 #  define _GET_KINFO_COMM(kp) (kp.p_comm)
 #  define _GET_KINFO_PID(kp) (kp.p_pid)
+#  define _GET_KINFO_PPID(kp) (kp.p_ppid)
 #  define _KVM_PATH NULL
 #  define _KVM_FLAGS KVM_NO_FILES
 # else
@@ -231,30 +314,31 @@ librc_hidden_def(rc_find_pids)
 #    define _GET_KINFO_UID(kp) (kp.kp_ruid)
 #    define _GET_KINFO_COMM(kp) (kp.kp_comm)
 #    define _GET_KINFO_PID(kp) (kp.kp_pid)
+#    define _GET_KINFO_PPID(kp) (kp.kp_ppid)
 #  else
 #    define _GET_KINFO_UID(kp) (kp.ki_ruid)
 #    define _GET_KINFO_COMM(kp) (kp.ki_comm)
 #    define _GET_KINFO_PID(kp) (kp.ki_pid)
+#    define _GET_KINFO_PPID(kp) (kp.ki_ppid)
 #  endif
 #  define _KVM_PATH _PATH_DEVNULL
 #  define _KVM_FLAGS O_RDONLY
 # endif
 
-RC_PIDLIST *
-rc_find_pids(const char *exec, const char *const *argv, uid_t uid, pid_t pid)
+static RC_PROCS *
+proc_snapshot(const struct proc_query *q)
 {
-	static kvm_t *kd = NULL;
+	kvm_t *kd = NULL;
 	char errbuf[_POSIX2_LINE_MAX];
 	struct _KINFO_PROC *kp;
 	int i;
 	int processes = 0;
 	int pargc = 0;
 	char **pargv;
-	RC_PIDLIST *pids = NULL;
-	RC_PID *pi;
-	pid_t p;
-	const char *const *arg;
-	int match;
+	char cmdline[PATH_MAX];
+	size_t len, n;
+	RC_PROC proc;
+	RC_PROCS *procs;
 
 	if ((kd = kvm_openfiles(_KVM_PATH, _KVM_PATH,
 		    NULL, _KVM_FLAGS, errbuf)) == NULL)
@@ -274,51 +358,140 @@ rc_find_pids(const char *exec, const char *const *argv, uid_t uid, pid_t pid)
 		return NULL;
 	}
 
-	if (exec)
-		exec = basename_c(exec);
+	procs = procs_new();
 	for (i = 0; i < processes; i++) {
-		p = _GET_KINFO_PID(kp[i]);
-		if (pid != 0 && pid != p)
+		memset(&proc, 0, sizeof(proc));
+		proc.pid = _GET_KINFO_PID(kp[i]);
+		if (q && ((q->pid != 0 && q->pid != proc.pid) ||
+		    proc.pid == procs->openrc_pid))
 			continue;
-		if (uid != 0 && uid != _GET_KINFO_UID(kp[i]))
+		proc.uid = _GET_KINFO_UID(kp[i]);
+		if (q && q->uid != 0 && q->uid != proc.uid)
 			continue;
-		if (exec) {
-			if (!_GET_KINFO_COMM(kp[i]) ||
-			    strcmp(exec, _GET_KINFO_COMM(kp[i])) != 0)
-				continue;
-		}
-		if (argv && *argv) {
+		proc.ppid = _GET_KINFO_PPID(kp[i]);
+		snprintf(proc.comm, sizeof(proc.comm), "%s",
+		    _GET_KINFO_COMM(kp[i]));
+		if (q && q->exec && strcmp(proc.comm, q->exec) != 0)
+			continue;
+		len = 0;
+		if (!q || q->argv) {
 			pargv = _KVM_GETARGV(kd, &kp[i], pargc);
-			if (!pargv || !*pargv)
-				continue;
-			arg = argv;
-			match = 1;
-			while (*arg && *pargv)
-				if (strcmp(*arg++, *pargv++) != 0) {
-					match = 0;
+			for (; pargv && *pargv; pargv++) {
+				n = strlen(*pargv) + 1;
+				if (len + n > sizeof(cmdline))
 					break;
-				}
-			if (!match)
+				memcpy(cmdline + len, *pargv, n);
+				len += n;
+			}
+			if (q && !argv_match(cmdline, len, q->argv))
 				continue;
 		}
+		procs_add(procs, &proc, cmdline, len);
+	}
+	kvm_close(kd);
+	return procs;
+}
+
+#else
+#  error "Platform not supported!"
+#endif
+
+RC_PROCS *
+rc_procs_snapshot(void)
+{
+	RC_PROCS *procs = proc_snapshot(NULL);
+
+	if (procs && procs->count)
+		qsort(procs->procs, procs->count, sizeof(*procs->procs),
+		    proc_cmp);
+	return procs;
+}
+librc_hidden_def(rc_procs_snapshot)
+
+RC_PIDLIST *
+rc_procs_find(const RC_PROCS *procs, const char *exec,
+    const char *const *argv, uid_t uid, pid_t pid)
+{
+	const RC_PROC *p;
+	RC_PIDLIST *pids = NULL;
+	RC_PID *pi;
+	size_t i;
+
+	if (exec)
+		exec = basename_c(exec);
+	for (i = 0; i < procs->count; i++) {
+		p = &procs->procs[i];
+		if (procs->openrc_pid != 0 && procs->openrc_pid == p->pid)
+			continue;
+		if (pid != 0 && pid != p->pid)
+			continue;
+		if (uid != 0 && uid != p->uid)
+			continue;
+		if (exec && strcmp(exec, p->comm) != 0)
+			continue;
+		if (argv && !argv_match(p->cmdline, p->cmdline_len, argv))
+			continue;
+		if (p->container)
+			continue;
 		if (!pids) {
 			pids = xmalloc(sizeof(*pids));
 			LIST_INIT(pids);
 		}
 		pi = xmalloc(sizeof(*pi));
-		pi->pid = p;
+		pi->pid = p->pid;
 		LIST_INSERT_HEAD(pids, pi, entries);
 	}
-	kvm_close(kd);
+	return pids;
+}
+librc_hidden_def(rc_procs_find)
+
+const RC_PROC *
+rc_procs_get(const RC_PROCS *procs, pid_t pid)
+{
+	RC_PROC key;
+
+	key.pid = pid;
+	if (!procs->count)
+		return NULL;
+	return bsearch(&key, procs->procs, procs->count,
+	    sizeof(*procs->procs), proc_cmp);
+}
+librc_hidden_def(rc_procs_get)
+
+void
+rc_procs_free(RC_PROCS *procs)
+{
+	size_t i;
+
+	if (!procs)
+		return;
+	for (i = 0; i < procs->count; i++)
+		free(procs->procs[i].cmdline);
+	free(procs->procs);
+	free(procs);
+}
+librc_hidden_def(rc_procs_free)
 
+/* A snapshot holding only what the query matches */
+RC_PIDLIST *
+rc_find_pids(const char *exec, const char *const *argv, uid_t uid, pid_t pid)
+{
+	struct proc_query q;
+	RC_PROCS *procs;
+	RC_PIDLIST *pids;
+
+	q.exec = exec ? basename_c(exec) : NULL;
+	q.argv = argv;
+	q.uid = uid;
+	q.pid = pid;
+	if (!(procs = proc_snapshot(&q)))
+		return NULL;
+	pids = rc_procs_find(procs, exec, argv, uid, pid);
+	rc_procs_free(procs);
 	return pids;
 }
 librc_hidden_def(rc_find_pids)
 
-#else
-#  error "Platform not supported!"
-#endif
-
 static bool
 _match_daemon(const char *path, const char *file, RC_STRINGLIST *match)
 {
@@ -498,7 +671,7 @@ rc_service_started_daemon(const char *service,
 librc_hidden_def(rc_service_started_daemon)
 
 bool
-rc_service_daemons_crashed(const char *service)
+rc_service_daemons_crashed_in(const char *service, const RC_PROCS *procs)
 {
 	char dirpath[PATH_MAX];
 	DIR *dp;
@@ -523,6 +696,18 @@ rc_service_daemons_crashed(const char *service)
 	size_t i;
 	char *ch_root;
 	char *spidfile;
+	char *cgroup;
+	int populated;
+
+	/* Anything left in the service's cgroup means it is still running.
+	 * An empty group may just be supervise-daemon respawning, so then
+	 * we check the daemons as usual. */
+	if ((cgroup = rc_service_value_get(service, "cgroup"))) {
+		populated = rc_cgroup_populated(cgroup);
+		free(cgroup);
+		if (populated == 1)
+			return false;
+	}
 
 	path += snprintf(dirpath, sizeof(dirpath), RC_SVCDIR "/daemons/%s",
 	    basename_c(service));
@@ -623,9 +808,11 @@ rc_service_daemons_crashed(const char *service)
 			if (pid != 0) {
 				if (kill(pid, 0) == -1 && errno == ESRCH)
 					retval = true;
-			} else if ((pids = rc_find_pids(exec,
-				    (const char *const *)argv,
-				    0, pid)))
+			} else if ((pids = procs ?
+				    rc_procs_find(procs, exec,
+				    (const char *const *)argv, 0, pid) :
+				    rc_find_pids(exec,
+				    (const char *const *)argv, 0, pid)))
 			{
 				p1 = LIST_FIRST(pids);
 				while (p1) {
@@ -653,4 +840,11 @@ rc_service_daemons_crashed(const char *service)
 
 	return retval;
 }
+librc_hidden_def(rc_service_daemons_crashed_in)
+
+bool
+rc_service_daemons_crashed(const char *service)
+{
+	return rc_service_daemons_crashed_in(service, NULL);
+}
 librc_hidden_def(rc_service_daemons_crashed)
@@ -736,6 +736,113 @@ rc_deptree_update_needed(time_t *newest, char *file)
 }
 librc_hidden_def(rc_deptree_update_needed)
 
+static void
+write_depinfo(FILE *fp, const RC_DEPINFO *depinfo, size_t i)
+{
+	const RC_DEPTYPE *deptype;
+	const RC_STRING *s;
+	size_t k;
+
+	fprintf(fp, "depinfo_%zu_service='%s'\n", i, depinfo->service);
+	TAILQ_FOREACH(deptype, &depinfo->depends, entries) {
+		k = 0;
+		TAILQ_FOREACH(s, deptype->services, entries)
+			fprintf(fp, "depinfo_%zu_%s_%zu='%s'\n",
+			    i, deptype->type, k++, s->value);
+	}
+}
+
+/* The types openrc-run traces when starting and stopping a service */
+static const char *const start_types[] = {
+	"ineed", "iwant", "iuse", "iafter", NULL
+};
+static const char *const stop_types[] = {
+	"needsme", "wantsme", "usesme", "beforeme", NULL
+};
+
+/* Add a service and everything visit_service can reach from it through
+ * types. Providers of virtual services are always followed, as which one
+ * is used is only known when we run. */
+static void
+closure_visit(const RC_DEPTREE *deptree, const RC_DEPINFO *depinfo,
+    const char *const *types, RC_STRINGLIST *closure)
+{
+	static const char *const provides[] = {
+		"providedby", "iprovide", NULL
+	};
+	const char *const *typelists[] = { types, provides };
+	const char *const *type;
+	const RC_DEPTYPE *dt;
+	const RC_DEPINFO *di;
+	const RC_STRING *s;
+	size_t t;
+
+	if (rc_stringlist_find(closure, depinfo->service))
+		return;
+	rc_stringlist_add(closure, depinfo->service);
+	for (t = 0; t < ARRAY_SIZE(typelists); t++)
+		for (type = typelists[t]; *type; type++) {
+			if (!(dt = get_deptype(depinfo, *type)))
+				continue;
+			TAILQ_FOREACH(s, dt->services, entries)
+				if ((di = get_depinfo(deptree, s->value)))
+					closure_visit(deptree, di, types,
+					    closure);
+		}
+}
+
+/* Save a deptree for each service holding only the services it can reach
+ * when starting or stopping, so openrc-run need not load them all.
+ * Each is written to a temporary file and renamed into place, and they
+ * are all replaced before the main cache so none is older than it. */
+static void
+deptree_save_services(const RC_DEPTREE *deptree)
+{
+	const RC_DEPINFO *depinfo, *di;
+	RC_STRINGLIST *closure, *stop;
+	RC_STRING *s;
+	DIR *dp;
+	struct dirent *d;
+	FILE *fp;
+	char *file, *tmp;
+	size_t i;
+
+	if (mkdir(RC_DEPTREE_SERVICES, 0755) == -1 && errno != EEXIST)
+		return;
+	if ((dp = opendir(RC_DEPTREE_SERVICES))) {
+		while ((d = readdir(dp)))
+			if (d->d_name[0] != '.')
+				unlinkat(dirfd(dp), d->d_name, 0);
+		closedir(dp);
+	}
+
+	TAILQ_FOREACH(depinfo, deptree, entries) {
+		closure = rc_stringlist_new();
+		closure_visit(deptree, depinfo, start_types, closure);
+		stop = rc_stringlist_new();
+		closure_visit(deptree, depinfo, stop_types, stop);
+		TAILQ_FOREACH(s, stop, entries)
+			rc_stringlist_addu(closure, s->value);
+		rc_stringlist_free(stop);
+
+		xasprintf(&file, RC_DEPTREE_SERVICES "/%s", depinfo->service);
+		xasprintf(&tmp, RC_DEPTREE_SERVICES "/.%s", depinfo->service);
+		if ((fp = fopen(tmp, "w"))) {
+			i = 0;
+			TAILQ_FOREACH(s, closure, entries)
+				if ((di = get_depinfo(deptree, s->value)))
+					write_depinfo(fp, di, i++);
+			if (fclose(fp) == 0)
+				rename(tmp, file);
+			else
+				unlink(tmp);
+		}
+		free(tmp);
+		free(file);
+		rc_stringlist_free(closure);
+	}
+}
+
 /* This is a 7 phase operation
    Phase 1 is a shell script which loads each init script and config in turn
    and echos their dependency info to stdout
@@ -759,7 +866,7 @@ rc_deptree_update(void)
 	char *line = NULL;
 	size_t len = 0;
 	char *depend, *depends, *service, *type, *nosys, *onosys;
-	size_t i, k, l;
+	size_t i, l;
 	bool retval = true;
 	const char *sys = rc_sys();
 	struct utsname uts;
@@ -1039,22 +1146,11 @@ rc_deptree_update(void)
 	   This works and should be entirely shell parseable provided that depend
 	   names don't have any non shell variable characters in
 	   */
+	deptree_save_services(deptree);
 	if ((fp = fopen(RC_DEPTREE_CACHE, "w"))) {
 		i = 0;
-		TAILQ_FOREACH(depinfo, deptree, entries) {
-			fprintf(fp, "depinfo_%zu_service='%s'\n",
-				i, depinfo->service);
-			TAILQ_FOREACH(deptype, &depinfo->depends, entries) {
-				k = 0;
-				TAILQ_FOREACH(s, deptype->services, entries) {
-					fprintf(fp,
-						"depinfo_%zu_%s_%zu='%s'\n",
-						i, deptype->type, k, s->value);
-					k++;
-				}
-			}
-			i++;
-		}
+		TAILQ_FOREACH(depinfo, deptree, entries)
+			write_depinfo(fp, depinfo, i++);
 		fclose(fp);
 	} else {
 		fprintf(stderr, "fopen `%s': %s\n",
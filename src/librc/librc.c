@@ -829,7 +829,7 @@ rc_service_mark(const char *service, const RC_SERVICE state)
 librc_hidden_def(rc_service_mark)
 
 RC_SERVICE
-rc_service_state(const char *service)
+rc_service_state_in(const char *service, const RC_PROCS *procs)
 {
 	int i;
 	int state = RC_SERVICE_STOPPED;
@@ -850,7 +850,8 @@ rc_service_state(const char *service)
 	}
 
 	if (state & RC_SERVICE_STARTED) {
-		if (rc_service_daemons_crashed(service) && errno != EACCES)
+		if (rc_service_daemons_crashed_in(service, procs) &&
+		    errno != EACCES)
 			state |= RC_SERVICE_CRASHED;
 	}
 	if (state & RC_SERVICE_STOPPED) {
@@ -869,6 +870,13 @@ rc_service_state(const char *service)
 
 	return state;
 }
+librc_hidden_def(rc_service_state_in)
+
+RC_SERVICE
+rc_service_state(const char *service)
+{
+	return rc_service_state_in(service, NULL);
+}
 librc_hidden_def(rc_service_state)
 
 char *
@@ -60,6 +60,14 @@
 #define librc_hidden_proto(x) hidden_proto(x)
 #define librc_hidden_def(x) hidden_def(x)
 
+librc_hidden_proto(rc_cgroup_dir)
+librc_hidden_proto(rc_cgroup_fork)
+librc_hidden_proto(rc_cgroup_kill)
+librc_hidden_proto(rc_cgroup_open)
+librc_hidden_proto(rc_cgroup_populated)
+librc_hidden_proto(rc_cgroup_remove)
+librc_hidden_proto(rc_cgroup_set)
+librc_hidden_proto(rc_cgroup_wait)
 librc_hidden_proto(rc_conf_value)
 librc_hidden_proto(rc_config_list)
 librc_hidden_proto(rc_config_load)
@@ -77,6 +85,10 @@ librc_hidden_proto(rc_getfile)
 librc_hidden_proto(rc_getline)
 librc_hidden_proto(rc_newer_than)
 librc_hidden_proto(rc_proc_getent)
+librc_hidden_proto(rc_procs_find)
+librc_hidden_proto(rc_procs_free)
+librc_hidden_proto(rc_procs_get)
+librc_hidden_proto(rc_procs_snapshot)
 librc_hidden_proto(rc_older_than)
 librc_hidden_proto(rc_runlevel_exists)
 librc_hidden_proto(rc_runlevel_get)
@@ -89,6 +101,7 @@ librc_hidden_proto(rc_runlevel_stopping)
 librc_hidden_proto(rc_runlevel_unstack)
 librc_hidden_proto(rc_service_add)
 librc_hidden_proto(rc_service_daemons_crashed)
+librc_hidden_proto(rc_service_daemons_crashed_in)
 librc_hidden_proto(rc_service_daemon_set)
 librc_hidden_proto(rc_service_delete)
 librc_hidden_proto(rc_service_description)
@@ -106,6 +119,7 @@ librc_hidden_proto(rc_services_scheduled)
 librc_hidden_proto(rc_services_scheduled_by)
 librc_hidden_proto(rc_service_started_daemon)
 librc_hidden_proto(rc_service_state)
+librc_hidden_proto(rc_service_state_in)
 librc_hidden_proto(rc_service_value_get)
 librc_hidden_proto(rc_service_value_set)
 librc_hidden_proto(rc_stringlist_add)
@@ -0,0 +1,45 @@
+/*
+ * cgroup_set.c
+ * Create a service's cgroup2 group and write rc_cgroup_settings to it,
+ * for rc-cgroup.sh.
+ */
+
+/*
+ * Copyright (c) 2007-2015 The OpenRC Authors.
+ * See the Authors file at the top-level directory of this distribution and
+ * https://github.com/OpenRC/openrc/blob/master/AUTHORS
+ *
+ * This file is part of OpenRC. It is subject to the license terms in
+ * the LICENSE file found in the top-level directory of this
+ * distribution and at https://github.com/OpenRC/openrc/blob/master/LICENSE
+ * This file may not be copied, modified, propagated, or distributed
+ *    except according to the terms contained in the LICENSE file.
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "einfo.h"
+#include "rc.h"
+
+/* cgroup_set <directory> <settings> */
+int main(int argc, char **argv)
+{
+	int fd;
+	bool ok;
+
+	if (argc != 3)
+		eerrorx("usage: cgroup_set <directory> <settings>");
+	if ((fd = rc_cgroup_open(argv[1], NULL)) == -1)
+		eerrorx("cgroup_set: %s: %s", argv[1], strerror(errno));
+	ok = rc_cgroup_set(fd, argv[2]);
+	close(fd);
+	if (!ok)
+		eerrorx("cgroup_set: failed to apply all settings to %s",
+		    argv[1]);
+	return EXIT_SUCCESS;
+}
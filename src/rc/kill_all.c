@@ -16,7 +16,6 @@
  */
 
 
-#include <dirent.h>
 #include <errno.h>
 #include <getopt.h>
 #include <limits.h>
@@ -85,63 +84,37 @@ static int mount_proc(void)
 	return 0;
 }
 
-static bool is_user_process(pid_t pid)
+static bool is_user_process(const RC_PROCS *procs, pid_t pid)
 {
-	char *buf = NULL;
-	FILE *fp;
-	char *path = NULL;
-	pid_t temp_pid;
-	size_t size;
-	bool user_process = true;
+	const RC_PROC *proc;
+	size_t depth = 0;
 
-	while (pid >0 && user_process) {
-		if (pid == 2) {
-			user_process = false;
-			continue;
-		}
-		xasprintf(&path, "/proc/%d/status", pid);
-		fp = fopen(path, "r");
-		free(path);
+	while (pid > 0) {
+		if (pid == 2)
+			return false;
 		/*
-		 * if we could not open the file, the process disappeared, which
+		 * if the process is not in the snapshot, it disappeared, which
 		 * leaves us no way to determine for sure whether it was a user
 		 * process or kernel thread, so we say it is a kernel thread to
 		 * avoid accidentally killing it.
+		 * A reused pid could make the chain loop, so give up on that
+		 * too.
 		 */
-		if (!fp) {
-			user_process = false;
-			continue;
-		}
-		temp_pid = -1;
-		while (! feof(fp)) {
-			buf = NULL;
-			if (getline(&buf, &size, fp) != -1) {
-				sscanf(buf, "PPid: %d", &temp_pid);
-				free(buf);
-			} else {
-				free(buf);
-				break;
-			}
-		}
-		fclose(fp);
-		if (temp_pid == -1) {
-			syslog(LOG_ERR, "Unable to read pid from /proc/%d/status", pid);
-			user_process = false;
-			continue;
-		}
-		pid = temp_pid;
+		if (!(proc = rc_procs_get(procs, pid)) || depth++ > procs->count)
+			return false;
+		pid = proc->ppid;
 	}
-	return user_process;
+	return true;
 }
 
 static int signal_processes(int sig, RC_STRINGLIST *omits, bool dryrun)
 {
 	sigset_t signals;
 	sigset_t oldsigs;
-	DIR *dir;
-	struct dirent	*d;
+	RC_PROCS *procs;
 	char *buf = NULL;
 	pid_t pid;
+	size_t i;
 	int sendcount = 0;
 
 	kill(-1, SIGSTOP);
@@ -149,7 +122,7 @@ static int signal_processes(int sig, RC_STRINGLIST *omits, bool dryrun)
 	sigemptyset(&oldsigs);
 	sigprocmask(SIG_SETMASK, &signals, &oldsigs);
 	/*
-	 * Open the /proc directory.
+	 * Take a snapshot of the process table.
 	 * CWD must be /proc to avoid problems if / is affected by the killing
 	 * (i.e. depends on fuse).
 	 */
@@ -159,20 +132,17 @@ static int signal_processes(int sig, RC_STRINGLIST *omits, bool dryrun)
 		kill(-1, SIGCONT);
 		return -1;
 	}
-	dir = opendir(".");
-	if (!dir) {
-		syslog(LOG_ERR, "cannot opendir(/proc)");
+	procs = rc_procs_snapshot();
+	if (!procs) {
+		syslog(LOG_ERR, "cannot read the process table from /proc");
 		sigprocmask(SIG_SETMASK, &oldsigs, NULL);
 		kill(-1, SIGCONT);
 		return -1;
 	}
 
-	/* Walk through the directory. */
-	while ((d = readdir(dir)) != NULL) {
-		/* Is this a process? */
-		pid = (pid_t) atoi(d->d_name);
-		if (pid == 0)
-			continue;
+	/* Walk through the processes. */
+	for (i = 0; i < procs->count; i++) {
+		pid = procs->procs[i].pid;
 
 		/* Is this a process we have been requested to omit? */
 		if (buf) {
@@ -188,7 +158,7 @@ static int signal_processes(int sig, RC_STRINGLIST *omits, bool dryrun)
 			continue;
 
 		/* Is this a kernel thread? */
-		if (!is_user_process(pid))
+		if (!is_user_process(procs, pid))
 			continue;
 
 		if (dryrun)
@@ -196,7 +166,8 @@ static int signal_processes(int sig, RC_STRINGLIST *omits, bool dryrun)
 		else if (kill(pid, sig) == 0)
 			sendcount++;
 	}
-	closedir(dir);
+	free(buf);
+	rc_procs_free(procs);
 	sigprocmask(SIG_SETMASK, &oldsigs, NULL);
 	kill(-1, SIGCONT);
 	return sendcount;
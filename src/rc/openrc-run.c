@@ -19,7 +19,9 @@
 #include <sys/ioctl.h>
 #include <sys/file.h>
 #include <sys/param.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <sys/wait.h>
 
 #include <ctype.h>
@@ -50,17 +52,26 @@
 #include "einfo.h"
 #include "queue.h"
 #include "rc.h"
+#include "rc-config.h"
+#include "rc-helper.h"
 #include "rc-misc.h"
+#include "rc-native.h"
 #include "rc-plugin.h"
 #include "rc-selinux.h"
 #include "_usage.h"
 
 #define PREFIX_LOCK	RC_SVCDIR "/prefix.lock"
+#define PREFIX_IOV	64		/* iovecs per writev of prefixed output */
+#define PREFIX_READ	(BUFSIZ * 8)	/* most output we prefix at once */
 
 #define WAIT_INTERVAL	20000000	/* usecs to poll the lock file */
 #define WAIT_TIMEOUT	60		/* seconds until we timeout */
 #define WARN_TIMEOUT	10		/* warn about this every N seconds */
 
+#ifndef MSG_NOSIGNAL
+#  define MSG_NOSIGNAL	0
+#endif
+
 const char *applet = NULL;
 const char *extraopts = "stop | start | restart | describe | zap";
 const char *getoptstring = "dDsSvl:Z" getoptstring_COMMON;
@@ -84,16 +95,18 @@ const char *const longopts_help[] = {
 };
 const char *usagestring = NULL;
 
-static char *service, *runlevel, *ibsave, *prefix;
+static char *service, *runlevel, *ibsave, *prefix, *prefix_line;
 static RC_DEPTREE *deptree;
 static RC_STRINGLIST *applet_list, *services, *tmplist;
 static RC_STRINGLIST *restart_services;
 static RC_STRINGLIST *need_services;
 static RC_STRINGLIST *use_services;
 static RC_STRINGLIST *want_services;
+static RC_STRINGLIST *config_env;
+static bool config_checked;
 static RC_HOOK hook_out;
 static int exclusive_fd = -1, master_tty = -1;
-static bool sighup, in_background, deps, dry_run;
+static bool sighup, in_background, deps, dry_run, deptree_full;
 static pid_t service_pid;
 static int signal_pipe[2] = { -1, -1 };
 
@@ -262,6 +275,7 @@ cleanup(void)
 	rc_stringlist_free(need_services);
 	rc_stringlist_free(use_services);
 	rc_stringlist_free(want_services);
+	rc_stringlist_free(config_env);
 	rc_stringlist_free(services);
 	rc_stringlist_free(applet_list);
 	rc_stringlist_free(tmplist);
@@ -278,12 +292,35 @@ cleanup(void)
  * Why don't we use (f)printf, as it is thread-safe through POSIX already?
  * Bug: 360013
  */
+static ssize_t
+write_iov(int fd, struct iovec *iov, int n)
+{
+	ssize_t bytes, ret = 0;
+
+	while (n > 0) {
+		if ((bytes = writev(fd, iov, n)) == -1) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		ret += bytes;
+		/* Skip what a short write got through */
+		for (; n > 0 && (size_t)bytes >= iov->iov_len; iov++, n--)
+			bytes -= iov->iov_len;
+		if (n > 0) {
+			iov->iov_base = (char *)iov->iov_base + bytes;
+			iov->iov_len -= bytes;
+		}
+	}
+	return ret;
+}
+
 static int
-write_prefix(const char *buffer, size_t bytes, bool *prefixed)
+write_prefix(char *buffer, size_t bytes, bool *prefixed)
 {
-	size_t i, j;
-	const char *ec = ecolor(ECOLOR_HILITE);
-	const char *ec_normal = ecolor(ECOLOR_NORMAL);
+	size_t i, j, start = 0;
+	struct iovec iov[PREFIX_IOV];
+	int n = 0;
 	ssize_t ret = 0;
 	int fd = fileno(stdout), lock_fd = -1;
 
@@ -291,7 +328,7 @@ write_prefix(const char *buffer, size_t bytes, bool *prefixed)
 	 * Lock the prefix.
 	 * open() may fail here when running as user, as RC_SVCDIR may not be writable.
 	 */
-	lock_fd = open(PREFIX_LOCK, O_WRONLY | O_CREAT, 0664);
+	lock_fd = open(PREFIX_LOCK, O_WRONLY | O_CREAT | O_CLOEXEC, 0664);
 
 	if (lock_fd != -1) {
 		while (flock(lock_fd, LOCK_EX) != 0) {
@@ -304,6 +341,7 @@ write_prefix(const char *buffer, size_t bytes, bool *prefixed)
 	else
 		ewarnv("Couldn't open the prefix lock, please make sure you have enough permissions");
 
+	/* Gather whole lines between the prefixes and write the lot at once */
 	for (i = 0; i < bytes; i++) {
 		/* We don't prefix eend calls (cursor up) */
 		if (buffer[i] == '\033' && !*prefixed) {
@@ -316,40 +354,114 @@ write_prefix(const char *buffer, size_t bytes, bool *prefixed)
 		}
 
 		if (!*prefixed) {
-			ret += write(fd, ec, strlen(ec));
-			ret += write(fd, prefix, strlen(prefix));
-			ret += write(fd, ec_normal, strlen(ec_normal));
-			ret += write(fd, "|", 1);
+			if (n > PREFIX_IOV - 3) {
+				ret += write_iov(fd, iov, n);
+				n = 0;
+			}
+			if (i > start) {
+				iov[n].iov_base = buffer + start;
+				iov[n++].iov_len = i - start;
+				start = i;
+			}
+			iov[n].iov_base = prefix_line;
+			iov[n++].iov_len = strlen(prefix_line);
 			*prefixed = true;
 		}
 
 		if (buffer[i] == '\n')
 			*prefixed = false;
-		ret += write(fd, buffer + i, 1);
 	}
+	if (i > start) {
+		iov[n].iov_base = buffer + start;
+		iov[n++].iov_len = i - start;
+	}
+	if (n > 0)
+		ret += write_iov(fd, iov, n);
 
 	/* Release the lock */
-	close(lock_fd);
+	if (lock_fd != -1)
+		close(lock_fd);
 
 	return ret;
 }
 
+/* Whether our output may be mixed with that of other services,
+ * which is the only time we need to prefix it */
+static bool
+interleaved(void)
+{
+	const char *max;
+
+	if (!rc_conf_yesno("rc_parallel") ||
+	    rc_yesno(getenv("EINFO_QUIET")))
+		return false;
+	max = rc_conf_value("rc_parallel_max");
+	return !max || atoi(max) != 1;
+}
+
+/* Answer the requests waiting on the helper socket.
+ * Returns false once the script has closed it. */
+static bool
+helper_read(int fd, char **buf, size_t *len)
+{
+	char *line, *p, *reply;
+	ssize_t bytes;
+	size_t l, n;
+	bool marked = false;
+
+	*buf = xrealloc(*buf, *len + BUFSIZ + 1);
+	if ((bytes = read(fd, *buf + *len, BUFSIZ)) <= 0)
+		return bytes == -1 && errno == EINTR;
+	*len += bytes;
+	(*buf)[*len] = '\0';
+
+	line = *buf;
+	while ((p = strchr(line, '\n'))) {
+		*p++ = '\0';
+		reply = rc_helper_reply(line, &marked);
+		for (l = 0, n = strlen(reply); l < n; l += bytes)
+			if ((bytes = send(fd, reply + l, n - l,
+			    MSG_NOSIGNAL)) == -1)
+			{
+				if (errno != EINTR)
+					break;
+				bytes = 0;
+			}
+		free(reply);
+		line = p;
+	}
+	*len -= line - *buf;
+	memmove(*buf, line, *len);
+	if (marked)
+		sighup = true;
+	return true;
+}
+
+/* Run a command, prefixing its output when we are running in parallel.
+ * A cgroup to start it in, variables to export and a service whose
+ * limits to set may be given for the child, and openrc-run.sh gets the
+ * helper socket. */
 static int
-svc_exec(const char *arg1, const char *arg2)
+svc_run(char *const *argv, int cgroup_fd, RC_STRINGLIST *env,
+    const struct rc_native *limits, bool helper)
 {
 	int ret, fdout = fileno(stdout);
 	struct termios tt;
 	struct winsize ws;
 	int i;
 	int flags = 0;
-	struct pollfd fd[2];
+	struct pollfd fd[3];
 	int s;
-	char *buffer;
-	size_t bytes;
+	char *buffer, *request = NULL;
+	size_t bytes, request_len = 0;
+	ssize_t r = 0;
+	int helper_fd[2] = { -1, -1 };
+	char helper_env[12];
 	bool prefixed = false;
 	int slave_tty;
 	sigset_t sigchldmask;
 	sigset_t oldmask;
+	RC_STRING *var;
 
 	/* Setup our signal pipe */
 	if (pipe(signal_pipe) == -1)
@@ -379,9 +491,24 @@ svc_exec(const char *arg1, const char *arg2)
 		if (slave_tty >=0 &&
 		    (flags = fcntl(slave_tty, F_GETFD, 0)) == 0)
 			fcntl(slave_tty, F_SETFD, flags | FD_CLOEXEC);
+
+		/* So we can drain it before prefixing */
+		if (master_tty >= 0 &&
+		    (flags = fcntl(master_tty, F_GETFL, 0)) != -1)
+			fcntl(master_tty, F_SETFL, flags | O_NONBLOCK);
+		xasprintf(&prefix_line, "%s%s%s|", ecolor(ECOLOR_HILITE),
+		    prefix, ecolor(ECOLOR_NORMAL));
 	}
 
-	service_pid = fork();
+	/* Give the script a socket to ask us for the values and states
+	 * it would otherwise run a helper program for */
+	if (helper && rc_conf_yesno("rc_script_helper") &&
+	    socketpair(AF_UNIX, SOCK_STREAM, 0, helper_fd) == 0)
+		for (i = 0; i < 2; i++)
+			if ((flags = fcntl(helper_fd[i], F_GETFD, 0)) == 0)
+				fcntl(helper_fd[i], F_SETFD, flags | FD_CLOEXEC);
+
+	service_pid = rc_cgroup_fork(cgroup_fd);
 	if (service_pid == -1)
 		eerrorx("%s: fork: %s", service, strerror(errno));
 	if (service_pid == 0) {
@@ -390,53 +517,43 @@ svc_exec(const char *arg1, const char *arg2)
 			dup2(slave_tty, STDERR_FILENO);
 		}
 
-		if (exists(RC_SVCDIR "/openrc-run.sh")) {
-			if (arg2)
-				einfov("Executing: %s %s %s %s %s",
-					RC_SVCDIR "/openrc-run.sh", RC_SVCDIR "/openrc-run.sh",
-					service, arg1, arg2);
-			else
-				einfov("Executing: %s %s %s %s",
-					RC_SVCDIR "/openrc-run.sh", RC_SVCDIR "/openrc-run.sh",
-					service, arg1);
-			execl(RC_SVCDIR "/openrc-run.sh",
-			    RC_SVCDIR "/openrc-run.sh",
-			    service, arg1, arg2, (char *) NULL);
-			eerror("%s: exec `" RC_SVCDIR "/openrc-run.sh': %s",
-			    service, strerror(errno));
-			_exit(EXIT_FAILURE);
-		} else {
-			if (arg2)
-				einfov("Executing: %s %s %s %s %s",
-					RC_LIBEXECDIR "/sh/openrc-run.sh",
-					RC_LIBEXECDIR "/sh/openrc-run.sh",
-			    	service, arg1, arg2);
-			else
-				einfov("Executing: %s %s %s %s",
-					RC_LIBEXECDIR "/sh/openrc-run.sh",
-					RC_LIBEXECDIR "/sh/openrc-run.sh",
-			    	service, arg1);
-			execl(RC_LIBEXECDIR "/sh/openrc-run.sh",
-			    RC_LIBEXECDIR "/sh/openrc-run.sh",
-			    service, arg1, arg2, (char *) NULL);
-			eerror("%s: exec `" RC_LIBEXECDIR "/sh/openrc-run.sh': %s",
-			    service, strerror(errno));
-			_exit(EXIT_FAILURE);
+		unsetenv("RC_HELPER_FD");
+		if (helper_fd[1] >= 0 &&
+		    dup2(helper_fd[1], RC_HELPER_FD) == RC_HELPER_FD &&
+		    (helper_fd[1] != RC_HELPER_FD ||
+		    fcntl(RC_HELPER_FD, F_SETFD, 0) == 0))
+		{
+			snprintf(helper_env, sizeof(helper_env), "%d",
+			    RC_HELPER_FD);
+			setenv("RC_HELPER_FD", helper_env, 1);
 		}
+
+		if (env)
+			TAILQ_FOREACH(var, env, entries)
+				putenv(var->value);
+		if (limits)
+			rc_native_limits(limits);
+		execvp(argv[0], argv);
+		eerror("%s: exec `%s': %s", service, argv[0], strerror(errno));
+		_exit(EXIT_FAILURE);
 	}
 
-	buffer = xmalloc(sizeof(char) * BUFSIZ);
+	if (helper_fd[1] >= 0)
+		close(helper_fd[1]);
+	if (slave_tty >= 0)
+		close(slave_tty);
+
+	buffer = xmalloc(sizeof(char) * PREFIX_READ);
 	fd[0].fd = signal_pipe[0];
-	fd[0].events = fd[1].events = POLLIN;
-	fd[0].revents = fd[1].revents = 0;
-	if (master_tty >= 0) {
-		fd[1].fd = master_tty;
-		fd[1].events = POLLIN;
-		fd[1].revents = 0;
+	fd[1].fd = master_tty;
+	fd[2].fd = helper_fd[0];
+	for (i = 0; i < 3; i++) {
+		fd[i].events = POLLIN;
+		fd[i].revents = 0;
 	}
 
 	for (;;) {
-		if ((s = poll(fd, master_tty >= 0 ? 2 : 1, -1)) == -1) {
+		if ((s = poll(fd, 3, -1)) == -1) {
 			if (errno != EINTR) {
 				eerror("%s: poll: %s",
 				    service, strerror(errno));
@@ -446,10 +563,24 @@ svc_exec(const char *arg1, const char *arg2)
 
 		if (s > 0) {
 			if (fd[1].revents & (POLLIN | POLLHUP)) {
-				bytes = read(master_tty, buffer, BUFSIZ);
-				write_prefix(buffer, bytes, &prefixed);
+				/* Take all there is so parallel services
+				 * contend for the prefix lock less often */
+				bytes = 0;
+				while (bytes < PREFIX_READ &&
+				    (r = read(master_tty, buffer + bytes,
+				    PREFIX_READ - bytes)) > 0)
+					bytes += r;
+				if (bytes > 0)
+					write_prefix(buffer, bytes, &prefixed);
+				/* Nothing has the slave open any more */
+				if (r == 0 || (r == -1 && errno == EIO))
+					fd[1].fd = -1;
 			}
 
+			if (fd[2].revents & (POLLIN | POLLHUP) &&
+			    !helper_read(helper_fd[0], &request, &request_len))
+				fd[2].fd = -1;
+
 			/* Only SIGCHLD signals come down this pipe */
 			if (fd[0].revents & (POLLIN | POLLHUP))
 				break;
@@ -457,6 +588,9 @@ svc_exec(const char *arg1, const char *arg2)
 	}
 
 	free(buffer);
+	free(request);
+	if (helper_fd[0] >= 0)
+		close(helper_fd[0]);
 
 	sigemptyset (&sigchldmask);
 	sigaddset (&sigchldmask, SIGCHLD);
@@ -474,6 +608,8 @@ svc_exec(const char *arg1, const char *arg2)
 		close(master_tty);
 		master_tty = -1;
 	}
+	free(prefix_line);
+	prefix_line = NULL;
 
 	ret = rc_waitpid(service_pid);
 	ret = WEXITSTATUS(ret);
@@ -485,6 +621,107 @@ svc_exec(const char *arg1, const char *arg2)
 	return ret;
 }
 
+/* openrc-run.sh checks this before it applies cgroup settings,
+ * so look once here rather than have it run grep every time. */
+static void
+setenv_cgroup_mounted(void)
+{
+	static bool checked;
+	FILE *fp;
+	char *line = NULL;
+	size_t len = 0;
+	bool mounted = false;
+
+	if (checked)
+		return;
+	checked = true;
+	if ((fp = fopen("/proc/1/mountinfo", "r"))) {
+		while (!mounted && getline(&line, &len, fp) != -1)
+			mounted = strstr(line, "/sys/fs/cgroup") != NULL;
+		fclose(fp);
+		free(line);
+	}
+	setenv("RC_CGROUP_MOUNTED", mounted ? "YES" : "NO", 1);
+}
+
+static int
+svc_exec(const char *arg1, const char *arg2)
+{
+	const char *file = RC_LIBEXECDIR "/sh/openrc-run.sh";
+	char *argv[] = { NULL, service, NULL, NULL, NULL };
+
+	if (exists(RC_SVCDIR "/openrc-run.sh"))
+		file = RC_SVCDIR "/openrc-run.sh";
+	argv[0] = UNCONST(file);
+	argv[2] = UNCONST(arg1);
+	argv[3] = UNCONST(arg2);
+	if (arg2)
+		einfov("Executing: %s %s %s %s %s",
+		    file, file, service, arg1, arg2);
+	else
+		einfov("Executing: %s %s %s %s", file, file, service, arg1);
+	if (!config_checked) {
+		config_env = rc_config_env(service, applet, runlevel);
+		config_checked = true;
+	}
+	if (strcmp(arg1, "status") != 0 && strcmp(arg1, "describe") != 0)
+		setenv_cgroup_mounted();
+	return svc_run(argv, -1, config_env, NULL, true);
+}
+
+/* Start or stop a simple service without openrc-run.sh.
+ * Returns -1 if the service needs the shell. */
+static int
+svc_native(const char *cmd)
+{
+	struct rc_native *native;
+	const char *name, *verbose;
+	char **argv;
+	int ret = 0, cgroup_fd = -1;
+
+	if (!rc_conf_yesno("rc_native_exec"))
+		return -1;
+	if (!(native = rc_native_load(service, applet, runlevel)))
+		return -1;
+
+	if (!(name = rc_native_value(native, "name")) || !*name)
+		name = applet;
+	if (!(verbose = rc_native_value(native, "rc_verbose")) || !*verbose)
+		verbose = getenv("RC_VERBOSE");
+	if (rc_yesno(verbose))
+		setenv("EINFO_VERBOSE", "yes", 1);
+
+	if (!rc_native_required(native, applet)) {
+		rc_native_free(native);
+		return 1;
+	}
+
+	if (strcmp(cmd, "start") == 0) {
+		argv = rc_native_start(native, applet);
+		einfov("Executing: %s", argv[0]);
+		ebegin("Starting %s", name);
+		if (native->cgroup)
+			cgroup_fd = rc_cgroup_open(native->cgroup,
+			    rc_native_value(native, "rc_cgroup_settings"));
+		ret = svc_run(argv, cgroup_fd, native->env, native, false);
+		if (cgroup_fd != -1)
+			close(cgroup_fd);
+		if (ret == 0)
+			rc_native_started(native, applet);
+		eend(ret, "%s to start %s",
+		    native->supervised ? "failed" : "Failed", name);
+	} else if ((argv = rc_native_stop(native, applet))) {
+		einfov("Executing: %s", argv[0]);
+		ebegin("Stopping %s", name);
+		ret = svc_run(argv, -1, native->env, native, false);
+		eend(ret, "Failed to stop %s", name);
+		rc_native_cgroup_remove(native);
+	}
+
+	rc_native_free(native);
+	return ret;
+}
+
 static bool
 svc_wait(const char *svc)
 {
@@ -654,7 +891,7 @@ svc_start_deps(void)
 	if (rc_conf_yesno("rc_depend_strict") || errno == ENOENT)
 		depoptions |= RC_DEP_STRICT;
 
-	if (!deptree && ((deptree = _rc_deptree_load(0, NULL)) == NULL))
+	if (!deptree && ((deptree = _rc_deptree_load_service(applet)) == NULL))
 		eerrorx("failed to load deptree");
 	if (!deptypes_b)
 		setup_deptypes();
@@ -791,13 +1028,16 @@ svc_start_deps(void)
 static void svc_start_real()
 {
 	bool started;
+	int ret;
 	RC_STRING *svc, *svc2;
 
 	if (ibsave)
 		setenv("IN_BACKGROUND", ibsave, 1);
 	hook_out = RC_HOOK_SERVICE_START_DONE;
 	rc_plugin_run(RC_HOOK_SERVICE_START_NOW, applet);
-	started = (svc_exec("start", NULL) == 0);
+	if ((ret = svc_native("start")) == -1)
+		ret = svc_exec("start", NULL);
+	started = (ret == 0);
 	if (ibsave)
 		unsetenv("IN_BACKGROUND");
 
@@ -912,7 +1152,7 @@ svc_stop_deps(RC_SERVICE state)
 	if (rc_conf_yesno("rc_depend_strict") || errno == ENOENT)
 		depoptions |= RC_DEP_STRICT;
 
-	if (!deptree && ((deptree = _rc_deptree_load(0, NULL)) == NULL))
+	if (!deptree && ((deptree = _rc_deptree_load_service(applet)) == NULL))
 		eerrorx("failed to load deptree");
 
 	if (!deptypes_m)
@@ -993,6 +1233,7 @@ static void
 svc_stop_real(void)
 {
 	bool stopped;
+	int ret;
 
 	/* If we're stopping localmount, set LC_ALL=C so that
 	 * bash doesn't load anything blocking the unmounting of /usr */
@@ -1003,7 +1244,9 @@ svc_stop_real(void)
 		setenv("IN_BACKGROUND", ibsave, 1);
 	hook_out = RC_HOOK_SERVICE_STOP_DONE;
 	rc_plugin_run(RC_HOOK_SERVICE_STOP_NOW, applet);
-	stopped = (svc_exec("stop", NULL) == 0);
+	if ((ret = svc_native("stop")) == -1)
+		ret = svc_exec("stop", NULL);
+	stopped = (ret == 0);
 	if (ibsave)
 		unsetenv("IN_BACKGROUND");
 
@@ -1109,6 +1352,25 @@ service_plugable(void)
 	return allow;
 }
 
+/* When boot readahead is recording without fanotify, tell it which
+ * files we are about to use. */
+static void
+readahead_trace(void)
+{
+	char *dir, *conf;
+	FILE *fp;
+
+	if (!(fp = fopen(RC_READAHEAD_TRACE, "a")))
+		return;
+	conf = xstrdup(service);
+	dir = dirname(dirname(conf));
+	fprintf(fp, "%s\n%s/conf.d/%s\n", service, dir, applet);
+	if (runlevel)
+		fprintf(fp, "%s/conf.d/%s.%s\n", dir, applet, runlevel);
+	free(conf);
+	fclose(fp);
+}
+
 int main(int argc, char **argv)
 {
 	bool doneone = false;
@@ -1195,6 +1457,9 @@ int main(int argc, char **argv)
 	setenv("EINFO_LOG", service, 1);
 	setenv("RC_SVCNAME", applet, 1);
 
+	if (exists(RC_READAHEAD_TRACE))
+		readahead_trace();
+
 	/* Set an env var so that we always know our pid regardless of any
 	   subshells the init script may create so that our mark_service_*
 	   functions can always instruct us of this change */
@@ -1207,7 +1472,7 @@ int main(int argc, char **argv)
 	setenv("RC_RUNSCRIPT_PID", pidstr, 1);
 
 	/* eprefix is kinda klunky, but it works for our purposes */
-	if (rc_conf_yesno("rc_parallel")) {
+	if (interleaved()) {
 		/* Get the longest service name */
 		services = rc_services_in_runlevel(NULL);
 		TAILQ_FOREACH(svc, services, entries) {
@@ -1352,9 +1617,14 @@ int main(int argc, char **argv)
 			    errno == ENOENT)
 				depoptions |= RC_DEP_STRICT;
 
-			if (!deptree &&
-			    ((deptree = _rc_deptree_load(0, NULL)) == NULL))
-				eerrorx("failed to load deptree");
+			/* Other types may reach outside our part of it */
+			if (!deptree_full) {
+				rc_deptree_free(deptree);
+				deptree = _rc_deptree_load(0, NULL);
+				if (!deptree)
+					eerrorx("failed to load deptree");
+				deptree_full = true;
+			}
 
 			tmplist = rc_stringlist_new();
 			rc_stringlist_add(tmplist, optarg);
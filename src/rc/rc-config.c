@@ -0,0 +1,432 @@
+/*
+ * rc-config.c
+ * Find and cache the configuration openrc-run.sh loads for a service.
+ *
+ * Before doing anything openrc-run.sh sources rc.conf, rc.conf.d and up
+ * to two conf.d files for the service. When all of those files only
+ * assign variables, openrc-run.sh saves the values it ends up with in
+ * RC_SVCDIR/config, one file per service and runlevel, headed by a key
+ * made from every file it sourced. While the key matches we tell it to
+ * source the saved values instead.
+ */
+
+/*
+ * Copyright (c) 2007-2015 The OpenRC Authors.
+ * See the Authors file at the top-level directory of this distribution and
+ * https://github.com/OpenRC/openrc/blob/master/AUTHORS
+ *
+ * This file is part of OpenRC. It is subject to the license terms in
+ * the LICENSE file found in the top-level directory of this
+ * distribution and at https://github.com/OpenRC/openrc/blob/master/LICENSE
+ * This file may not be copied, modified, propagated, or distributed
+ *    except according to the terms contained in the LICENSE file.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "queue.h"
+#include "rc.h"
+#include "rc-config.h"
+#include "rc-misc.h"
+
+#define RC_CONFIG_DIR	RC_SVCDIR "/config"
+
+#define FNV_PRIME	UINT64_C(1099511628211)
+
+/* Variables which differ between runs of the same service */
+static const char *const changing[] = {
+	"IN_BACKGROUND", "IN_DRYRUN", "IN_HOTPLUG", "RC_CMD", "RC_GOINGDOWN",
+	"RC_REBOOT",
+};
+
+/* The keys of our caches and those of rc-native.c and rc-plan.c are
+ * FNV-1a hashes, started at FNV_OFFSET, of what the cached data came from */
+void
+hash_bytes(uint64_t *hash, const void *data, size_t len)
+{
+	const unsigned char *p = data;
+
+	while (len--) {
+		*hash ^= *p++;
+		*hash *= FNV_PRIME;
+	}
+}
+
+void
+hash_string(uint64_t *hash, const char *s)
+{
+	if (s)
+		hash_bytes(hash, s, strlen(s) + 1);
+	else
+		hash_bytes(hash, "", 1);
+}
+
+/* Files are told apart by name, inode, size and mtime */
+void
+hash_stat(uint64_t *hash, const char *file)
+{
+	struct stat st;
+
+	hash_string(hash, file);
+	if (stat(file, &st) == 0) {
+		hash_bytes(hash, &st.st_ino, sizeof(st.st_ino));
+		hash_bytes(hash, &st.st_size, sizeof(st.st_size));
+		hash_bytes(hash, &st.st_mtime, sizeof(st.st_mtime));
+	} else
+		hash_string(hash, NULL);
+}
+
+/* rc.conf and the .conf files in rc.conf.d, in the order we source them */
+static RC_STRINGLIST *
+global_files(void)
+{
+	RC_STRINGLIST *names = rc_stringlist_new();
+	RC_STRINGLIST *list = rc_stringlist_new();
+	RC_STRING *s;
+	DIR *dp;
+	struct dirent *d;
+	char *file;
+	size_t len;
+
+	rc_stringlist_add(list, RC_CONF);
+	if ((dp = opendir(RC_SYSCONFDIR "/rc.conf.d"))) {
+		while ((d = readdir(dp))) {
+			len = strlen(d->d_name);
+			if (len > 5 && strcmp(d->d_name + len - 5, ".conf") == 0)
+				rc_stringlist_add(names, d->d_name);
+		}
+		closedir(dp);
+	}
+	rc_stringlist_sort(&names);
+	TAILQ_FOREACH(s, names, entries) {
+		xasprintf(&file, RC_SYSCONFDIR "/rc.conf.d/%s", s->value);
+		rc_stringlist_add(list, file);
+		free(file);
+	}
+	rc_stringlist_free(names);
+	return list;
+}
+
+/* The conf.d files openrc-run.sh looks for, in the order it does.
+ * A multiplexed service such as net.eth0 also reads the net files. */
+RC_STRINGLIST *
+rc_config_files(const char *script, const char *svcname, const char *runlevel)
+{
+	RC_STRINGLIST *list = rc_stringlist_new();
+	char *dir = xstrdup(script);
+	char *base = xstrdup(svcname);
+	char *p, *file;
+
+	if ((p = strrchr(dir, '/')))
+		*p = '\0';
+	if ((p = strchr(base, '.')))
+		*p = '\0';
+	if (*base && strcmp(base, svcname) != 0) {
+		xasprintf(&file, "%s/../conf.d/%s.%s", dir, base, runlevel);
+		rc_stringlist_add(list, file);
+		free(file);
+		xasprintf(&file, "%s/../conf.d/%s", dir, base);
+		rc_stringlist_add(list, file);
+		free(file);
+	}
+	xasprintf(&file, "%s/../conf.d/%s.%s", dir, svcname, runlevel);
+	rc_stringlist_add(list, file);
+	free(file);
+	xasprintf(&file, "%s/../conf.d/%s", dir, svcname);
+	rc_stringlist_add(list, file);
+	free(file);
+	free(base);
+	free(dir);
+	return list;
+}
+
+/* Does the service have configuration only for this runlevel? */
+bool
+rc_config_runlevel(const char *script, const char *svcname,
+    const char *runlevel)
+{
+	RC_STRINGLIST *list = rc_config_files(script, svcname, runlevel);
+	RC_STRING *s;
+	size_t len = strlen(runlevel) + 1;
+	size_t l;
+	bool retval = false;
+
+	TAILQ_FOREACH(s, list, entries) {
+		l = strlen(s->value);
+		if (l > len && s->value[l - len] == '.' &&
+		    strcmp(s->value + l - len + 1, runlevel) == 0 &&
+		    exists(s->value))
+			retval = true;
+	}
+	rc_stringlist_free(list);
+	return retval;
+}
+
+char *
+rc_config_key(const char *script, const char *svcname, const char *runlevel)
+{
+	RC_STRINGLIST *list;
+	RC_STRING *s;
+	uint64_t hash = FNV_OFFSET;
+	char *key;
+
+	hash_string(&hash, svcname);
+	hash_string(&hash, runlevel);
+	hash_stat(&hash, RC_SYSCONFDIR "/rc.conf.d");
+	list = global_files();
+	TAILQ_FOREACH(s, list, entries)
+		hash_stat(&hash, s->value);
+	rc_stringlist_free(list);
+	list = rc_config_files(script, svcname, runlevel);
+	TAILQ_FOREACH(s, list, entries)
+		hash_stat(&hash, s->value);
+	rc_stringlist_free(list);
+
+	xasprintf(&key, "%016llx", (unsigned long long)hash);
+	return key;
+}
+
+static bool
+refers_changing(const char *p)
+{
+	size_t i, len;
+
+	for (i = 0; i < ARRAY_SIZE(changing); i++) {
+		len = strlen(changing[i]);
+		if (strncmp(p, changing[i], len) == 0 &&
+		    !isalnum((unsigned char)p[len]) && p[len] != '_')
+			return true;
+	}
+	return false;
+}
+
+/* Collect the variables a file assigns, if that is all it does.
+ * Values may be quoted over several lines, but anything else which
+ * could run a command, or depends on how we were called, makes the
+ * file unsuitable for caching.
+ * A service script may also define functions, as they only run when
+ * called. Their bodies are skipped up to a } in the first column. */
+static bool
+plain_file(const char *file, RC_STRINGLIST *vars, RC_STRINGLIST *exports,
+    bool script)
+{
+	FILE *fp;
+	char *line = NULL, *p, *name;
+	size_t len = 0, n;
+	char quote = '\0';
+	bool plain = true, export, assign, body = false;
+
+	if (!(fp = fopen(file, "r")))
+		return errno == ENOENT;
+	while (plain && getline(&line, &len, fp) != -1) {
+		p = line;
+		if (body) {
+			body = *line != '}';
+			continue;
+		}
+		if (!quote) {
+			p += strspn(p, " \t");
+			if (*p == '\0' || *p == '\n' || *p == '#')
+				continue;
+			export = strncmp(p, "export", 6) == 0 &&
+			    (p[6] == ' ' || p[6] == '\t');
+			if (export)
+				p += 6 + strspn(p + 6, " \t");
+			if (script && !export && strncmp(p, "function", 8) == 0 &&
+			    (p[8] == ' ' || p[8] == '\t'))
+				p += 8 + strspn(p + 8, " \t");
+			name = p;
+			if (!isalpha((unsigned char)*p) && *p != '_') {
+				plain = false;
+				continue;
+			}
+			for (n = 0; isalnum((unsigned char)p[n]) || p[n] == '_'; n++)
+				;
+			p += n;
+			if (script && !export &&
+			    strncmp(p + strspn(p, " \t"), "()", 2) == 0) {
+				/* Unless it all fits on this line */
+				body = strchr(p, '}') == NULL;
+				continue;
+			}
+			assign = *p == '=';
+			if (!assign && !(export && (*p == '\n' || *p == '\0'))) {
+				plain = false;
+				continue;
+			}
+			name[n] = '\0';
+			if (!rc_stringlist_find(vars, name))
+				rc_stringlist_add(vars, name);
+			if (export && !rc_stringlist_find(exports, name))
+				rc_stringlist_add(exports, name);
+			if (!assign)
+				continue;
+			p++;
+		}
+
+		for (; plain && *p; p++) {
+			if (quote == '\'') {
+				if (*p == '\'')
+					quote = '\0';
+				continue;
+			}
+			if (*p == '\\') {
+				if (*++p == '\0' || (*p == '\n' && !quote))
+					plain = false;
+				continue;
+			}
+			if (*p == '`' || (*p == '$' && p[1] == '(')) {
+				plain = false;
+				continue;
+			}
+			if (*p == '$') {
+				if (refers_changing(p[1] == '{' ? p + 2 : p + 1))
+					plain = false;
+				continue;
+			}
+			if (*p == '"') {
+				quote = quote ? '\0' : '"';
+				continue;
+			}
+			if (quote)
+				continue;
+			if (*p == '\'') {
+				quote = '\'';
+				continue;
+			}
+			if (*p == '#' && p > line &&
+			    (p[-1] == ' ' || p[-1] == '\t'))
+				break;
+			if (strchr(";&|<>()", *p))
+				plain = false;
+			else if ((*p == ' ' || *p == '\t') &&
+			    p[strspn(p, " \t")] != '\n' &&
+			    p[strspn(p, " \t")] != '\0' &&
+			    p[strspn(p, " \t")] != '#')
+				plain = false;
+		}
+	}
+	free(line);
+	fclose(fp);
+	return plain && !quote && !body;
+}
+
+/* Does the file only assign variables, or if it is a service script,
+ * also define functions? */
+bool
+rc_config_plain(const char *file, bool script)
+{
+	RC_STRINGLIST *vars = rc_stringlist_new();
+	RC_STRINGLIST *exports = rc_stringlist_new();
+	bool plain;
+
+	plain = plain_file(file, vars, exports, script);
+	rc_stringlist_free(vars);
+	rc_stringlist_free(exports);
+	return plain;
+}
+
+static char *
+join(RC_STRINGLIST *list)
+{
+	RC_STRING *s;
+	char *str = NULL, *tmp;
+
+	TAILQ_FOREACH(s, list, entries) {
+		if (str) {
+			xasprintf(&tmp, "%s %s", str, s->value);
+			free(str);
+			str = tmp;
+		} else
+			str = xstrdup(s->value);
+	}
+	return str ? str : xstrdup("");
+}
+
+/* Work out what to tell openrc-run.sh about the cache for a service.
+ * Returns the variables to export to it, or NULL if it should load
+ * its configuration as it always has. */
+RC_STRINGLIST *
+rc_config_env(const char *script, const char *svcname, const char *runlevel)
+{
+	RC_STRINGLIST *env = NULL, *files, *tmp, *vars, *exports;
+	RC_STRING *s;
+	FILE *fp;
+	char *file = NULL, *key, *line = NULL, *str, *var;
+	size_t len = 0;
+	bool plain = true;
+
+	errno = 0;
+	if (!rc_conf_yesno("rc_config_cache") && errno != ENOENT)
+		return NULL;
+	if (!runlevel)
+		runlevel = "";
+
+	key = rc_config_key(script, svcname, runlevel);
+	xasprintf(&file, RC_CONFIG_DIR "/%s.%s", svcname, runlevel);
+	if ((fp = fopen(file, "r"))) {
+		if (getline(&line, &len, fp) != -1 &&
+		    strncmp(line, "# ", 2) == 0 &&
+		    strncmp(line + 2, key, strlen(key)) == 0 &&
+		    line[strlen(key) + 2] == '\n')
+		{
+			env = rc_stringlist_new();
+			xasprintf(&var, "RC_CONFIG_CACHE=%s", file);
+			rc_stringlist_add(env, var);
+			free(var);
+		}
+		free(line);
+		fclose(fp);
+	}
+	if (env || (mkdir(RC_CONFIG_DIR, 0700) != 0 && errno != EEXIST) ||
+	    access(RC_CONFIG_DIR, W_OK) != 0)
+		goto out;
+
+	vars = rc_stringlist_new();
+	exports = rc_stringlist_new();
+	files = global_files();
+	tmp = rc_config_files(script, svcname, runlevel);
+	TAILQ_CONCAT(files, tmp, entries);
+	free(tmp);
+	TAILQ_FOREACH(s, files, entries)
+		if (!(plain = plain_file(s->value, vars, exports, false)))
+			break;
+	if (plain) {
+		env = rc_stringlist_new();
+		xasprintf(&var, "RC_CONFIG_SAVE=%s", file);
+		rc_stringlist_add(env, var);
+		free(var);
+		xasprintf(&var, "RC_CONFIG_KEY=%s", key);
+		rc_stringlist_add(env, var);
+		free(var);
+		str = join(vars);
+		xasprintf(&var, "RC_CONFIG_VARS=%s", str);
+		rc_stringlist_add(env, var);
+		free(var);
+		free(str);
+		str = join(exports);
+		xasprintf(&var, "RC_CONFIG_EXPORTS=%s", str);
+		rc_stringlist_add(env, var);
+		free(var);
+		free(str);
+	}
+	rc_stringlist_free(files);
+	rc_stringlist_free(vars);
+	rc_stringlist_free(exports);
+
+out:
+	free(file);
+	free(key);
+	return env;
+}
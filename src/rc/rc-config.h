@@ -0,0 +1,39 @@
+/*
+ * rc-config.h
+ * Find and cache the configuration openrc-run.sh loads for a service.
+ */
+
+/*
+ * Copyright (c) 2007-2015 The OpenRC Authors.
+ * See the Authors file at the top-level directory of this distribution and
+ * https://github.com/OpenRC/openrc/blob/master/AUTHORS
+ *
+ * This file is part of OpenRC. It is subject to the license terms in
+ * the LICENSE file found in the top-level directory of this
+ * distribution and at https://github.com/OpenRC/openrc/blob/master/LICENSE
+ * This file may not be copied, modified, propagated, or distributed
+ *    except according to the terms contained in the LICENSE file.
+ */
+
+#ifndef RC_CONFIG_H
+#define RC_CONFIG_H
+
+#include <stdint.h>
+
+#define FNV_OFFSET	UINT64_C(14695981039346656037)
+
+void hash_bytes(uint64_t *hash, const void *data, size_t len);
+void hash_string(uint64_t *hash, const char *s);
+void hash_stat(uint64_t *hash, const char *file);
+
+RC_STRINGLIST *rc_config_files(const char *script, const char *svcname,
+    const char *runlevel);
+bool rc_config_runlevel(const char *script, const char *svcname,
+    const char *runlevel);
+char *rc_config_key(const char *script, const char *svcname,
+    const char *runlevel);
+bool rc_config_plain(const char *file, bool script);
+RC_STRINGLIST *rc_config_env(const char *script, const char *svcname,
+    const char *runlevel);
+
+#endif
@@ -0,0 +1,213 @@
+/*
+ * rc-helper.c
+ * Answer the helper requests service scripts send to openrc-run.
+ *
+ * When rc_script_helper is enabled openrc-run gives openrc-run.sh one end
+ * of a socket on fd RC_HELPER_FD and functions.sh wraps the applets below
+ * so they send their arguments down it instead of running a program.
+ * A request is one line holding RC_SVCNAME, the applet and its arguments,
+ * separated by \037. The reply is one line of "<status> <newline> <output>"
+ * where newline is 1 if the applet ends its output with one. A reply of
+ * "-" tells the script to run the applet itself.
+ */
+
+/*
+ * Copyright (c) 2007-2015 The OpenRC Authors.
+ * See the Authors file at the top-level directory of this distribution and
+ * https://github.com/OpenRC/openrc/blob/master/AUTHORS
+ *
+ * This file is part of OpenRC. It is subject to the license terms in
+ * the LICENSE file found in the top-level directory of this
+ * distribution and at https://github.com/OpenRC/openrc/blob/master/LICENSE
+ * This file may not be copied, modified, propagated, or distributed
+ *    except according to the terms contained in the LICENSE file.
+ */
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "queue.h"
+#include "rc.h"
+#include "rc-helper.h"
+#include "rc-misc.h"
+
+#define FIELD_SEP	'\037'
+
+static char *
+reply(bool ok, bool newline, const char *output)
+{
+	char *r;
+
+	/* Replies are one line, so let the applet print these itself */
+	if (output && strchr(output, '\n'))
+		return NULL;
+	xasprintf(&r, "%d %d %s\n", ok ? 0 : 1, newline ? 1 : 0,
+	    output ? output : "");
+	return r;
+}
+
+/* service_get_value and friends, see do_value.c */
+static char *
+helper_value(const char *svcname, int argc, char **argv)
+{
+	char *option, *r;
+
+	if (!*svcname || argc < 2 || !*argv[1])
+		return NULL;
+
+	if (strcmp(argv[0], "service_get_value") == 0 ||
+	    strcmp(argv[0], "get_options") == 0)
+	{
+		option = rc_service_value_get(svcname, argv[1]);
+		r = reply(option != NULL, false, option);
+		free(option);
+		return r;
+	}
+	return reply(rc_service_value_set(svcname, argv[1], argv[2]),
+	    false, NULL);
+}
+
+/* service_started and friends, see do_service.c */
+static char *
+helper_service(const char *svcname, int argc, char **argv)
+{
+	const char *service = argc > 1 ? argv[1] : svcname;
+	const char *exec;
+	RC_SERVICE bit;
+	int idx = 0;
+	bool ok;
+
+	if (!*service)
+		return NULL;
+
+	if ((bit = lookup_service_state(argv[0])))
+		ok = (rc_service_state(service) & bit);
+	else if (strcmp(argv[0], "service_started_daemon") == 0) {
+		if (argc < 2 || !*svcname)
+			return NULL;
+		service = svcname;
+		exec = argv[1];
+		if (argc > 3) {
+			service = argv[1];
+			exec = argv[2];
+			sscanf(argv[3], "%d", &idx);
+		} else if (argc == 3) {
+			if (sscanf(argv[2], "%d", &idx) != 1) {
+				service = argv[1];
+				exec = argv[2];
+			}
+		}
+		ok = rc_service_started_daemon(service, exec, NULL, idx);
+	} else if (strcmp(argv[0], "service_crashed") == 0)
+		ok = (rc_service_daemons_crashed(service) && errno != EACCES);
+	else
+		return NULL;
+
+	return reply(ok, false, NULL);
+}
+
+/* mark_service_started and friends, see do_mark_service.c */
+static char *
+helper_mark(const char *svcname, int argc, char **argv, bool *marked)
+{
+	const char *service = argc > 1 ? argv[1] : svcname;
+	RC_SERVICE bit;
+	bool ok;
+
+	if (!*service || !(bit = lookup_service_state(argv[0] + 5)))
+		return NULL;
+
+	ok = rc_service_mark(service, bit);
+	/* Where the applet would signal us */
+	if (ok && *svcname && strcmp(svcname, service) == 0)
+		*marked = true;
+	return reply(ok, false, NULL);
+}
+
+static char *
+helper_shell_var(int argc, char **argv)
+{
+	char *var, *p;
+	size_t len = 0;
+	int i;
+
+	for (i = 1; i < argc; i++)
+		len += strlen(argv[i]) + 1;
+	var = p = xmalloc(len + 1);
+	for (i = 1; i < argc; i++) {
+		if (i != 1)
+			*p++ = ' ';
+		for (; *argv[i]; argv[i]++)
+			*p++ = isalnum((unsigned char)*argv[i]) ?
+			    *argv[i] : '_';
+	}
+	*p = '\0';
+	p = reply(true, true, var);
+	free(var);
+	return p;
+}
+
+/* is_older_than and is_newer_than, which are the wrong way round */
+static char *
+helper_newer(int argc, char **argv)
+{
+	bool older = strcmp(argv[0], "is_older_than") == 0;
+	int i;
+
+	if (argc < 3)
+		return reply(false, false, NULL);
+	for (i = 2; i < argc; i++)
+		if (!rc_newer_than(argv[1], argv[i], NULL, NULL))
+			return reply(older, false, NULL);
+	return reply(!older, false, NULL);
+}
+
+/* Returns the reply line for a request read without its newline.
+ * marked is set if the script marked its own service. */
+char *
+rc_helper_reply(char *request, bool *marked)
+{
+	char **fields, *p, *svcname, *r = NULL;
+	char **argv;
+	int argc, n = 1;
+
+	for (p = request; *p; p++)
+		if (*p == FIELD_SEP)
+			n++;
+	fields = xmalloc(sizeof(char *) * (n + 1));
+	n = 0;
+	fields[n++] = request;
+	for (p = request; *p; p++)
+		if (*p == FIELD_SEP) {
+			*p = '\0';
+			fields[n++] = p + 1;
+		}
+	fields[n] = NULL;
+
+	svcname = fields[0];
+	argv = fields + 1;
+	argc = n - 1;
+	if (argc < 1)
+		r = NULL;
+	else if (strcmp(argv[0], "service_get_value") == 0 ||
+	    strcmp(argv[0], "service_set_value") == 0 ||
+	    strcmp(argv[0], "get_options") == 0 ||
+	    strcmp(argv[0], "save_options") == 0)
+		r = helper_value(svcname, argc, argv);
+	else if (strncmp(argv[0], "mark_service_", 13) == 0)
+		r = helper_mark(svcname, argc, argv, marked);
+	else if (strncmp(argv[0], "service_", 8) == 0)
+		r = helper_service(svcname, argc, argv);
+	else if (strcmp(argv[0], "shell_var") == 0)
+		r = helper_shell_var(argc, argv);
+	else if (strcmp(argv[0], "is_older_than") == 0 ||
+	    strcmp(argv[0], "is_newer_than") == 0)
+		r = helper_newer(argc, argv);
+
+	free(fields);
+	return r ? r : xstrdup("-\n");
+}
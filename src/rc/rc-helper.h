@@ -0,0 +1,26 @@
+/*
+ * rc-helper.h
+ * Answer the helper requests service scripts send to openrc-run.
+ */
+
+/*
+ * Copyright (c) 2007-2015 The OpenRC Authors.
+ * See the Authors file at the top-level directory of this distribution and
+ * https://github.com/OpenRC/openrc/blob/master/AUTHORS
+ *
+ * This file is part of OpenRC. It is subject to the license terms in
+ * the LICENSE file found in the top-level directory of this
+ * distribution and at https://github.com/OpenRC/openrc/blob/master/LICENSE
+ * This file may not be copied, modified, propagated, or distributed
+ *    except according to the terms contained in the LICENSE file.
+ */
+
+#ifndef RC_HELPER_H
+#define RC_HELPER_H
+
+/* The fd service scripts find the helper on */
+#define RC_HELPER_FD	8
+
+char *rc_helper_reply(char *request, bool *marked);
+
+#endif
@@ -0,0 +1,236 @@
+/*
+ * rc-jobs.c
+ * Track the service scripts we have forked and report when they finish.
+ *
+ * Our SIGCHLD handler just wakes up a self pipe. Children are reaped
+ * from the main loop and matched against a hash table of the jobs we
+ * started, so each completion can be handed to the scheduler along with
+ * its exit status and how long it took.
+ */
+
+/*
+ * Copyright (c) 2007-2015 The OpenRC Authors.
+ * See the Authors file at the top-level directory of this distribution and
+ * https://github.com/OpenRC/openrc/blob/master/AUTHORS
+ *
+ * This file is part of OpenRC. It is subject to the license terms in
+ * the LICENSE file found in the top-level directory of this
+ * distribution and at https://github.com/OpenRC/openrc/blob/master/LICENSE
+ * This file may not be copied, modified, propagated, or distributed
+ *    except according to the terms contained in the LICENSE file.
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "einfo.h"
+#include "queue.h"
+#include "rc.h"
+#include "rc-jobs.h"
+#include "rc-misc.h"
+
+#define JOB_BUCKETS	64	/* must be a power of two */
+
+struct rc_job {
+	pid_t pid;
+	char *service;
+	struct timespec start;
+	LIST_ENTRY(rc_job) entries;
+};
+LIST_HEAD(rc_job_list, rc_job);
+
+struct rc_job_event {
+	struct rc_job_done done;
+	TAILQ_ENTRY(rc_job_event) entries;
+};
+TAILQ_HEAD(rc_job_events, rc_job_event);
+
+static struct rc_job_list jobs[JOB_BUCKETS];
+static struct rc_job_events events = TAILQ_HEAD_INITIALIZER(events);
+static size_t njobs;
+static int job_pipe[2] = { -1, -1 };
+
+static struct rc_job_list *
+job_bucket(pid_t pid)
+{
+	return &jobs[(unsigned int)pid & (JOB_BUCKETS - 1)];
+}
+
+void
+rc_jobs_init(void)
+{
+	int i, flags;
+
+	for (i = 0; i < JOB_BUCKETS; i++)
+		LIST_INIT(&jobs[i]);
+	if (pipe(job_pipe) == -1)
+		eerrorx("pipe: %s", strerror(errno));
+	for (i = 0; i < 2; i++)
+		if ((flags = fcntl(job_pipe[i], F_GETFL, 0)) == -1 ||
+		    fcntl(job_pipe[i], F_SETFL, flags | O_NONBLOCK) == -1 ||
+		    (flags = fcntl(job_pipe[i], F_GETFD, 0)) == -1 ||
+		    fcntl(job_pipe[i], F_SETFD, flags | FD_CLOEXEC) == -1)
+			eerrorx("fcntl: %s", strerror(errno));
+}
+
+void
+rc_jobs_free(void)
+{
+	struct rc_job *job;
+	struct rc_job_event *ev;
+	int i;
+
+	for (i = 0; i < JOB_BUCKETS; i++)
+		while ((job = LIST_FIRST(&jobs[i]))) {
+			LIST_REMOVE(job, entries);
+			free(job->service);
+			free(job);
+		}
+	while ((ev = TAILQ_FIRST(&events))) {
+		TAILQ_REMOVE(&events, ev, entries);
+		free(ev->done.service);
+		free(ev);
+	}
+	njobs = 0;
+	for (i = 0; i < 2; i++)
+		if (job_pipe[i] != -1) {
+			close(job_pipe[i]);
+			job_pipe[i] = -1;
+		}
+}
+
+void
+rc_jobs_sigchld(void)
+{
+	int serrno = errno;
+	char c = 0;
+
+	/* If the pipe is full we already have a wakeup pending */
+	if (job_pipe[1] != -1 && write(job_pipe[1], &c, 1) == -1 &&
+	    errno != EAGAIN)
+		eerror("write: %s", strerror(errno));
+	errno = serrno;
+}
+
+void
+rc_jobs_add(pid_t pid, const char *service)
+{
+	struct rc_job *job = xmalloc(sizeof(*job));
+
+	job->pid = pid;
+	job->service = xstrdup(service);
+	clock_gettime(CLOCK_MONOTONIC, &job->start);
+	LIST_INSERT_HEAD(job_bucket(pid), job, entries);
+	njobs++;
+}
+
+size_t
+rc_jobs_running(void)
+{
+	return njobs;
+}
+
+void
+rc_jobs_signal(int sig)
+{
+	struct rc_job *job;
+	int i;
+
+	for (i = 0; i < JOB_BUCKETS; i++)
+		LIST_FOREACH(job, &jobs[i], entries)
+			kill(job->pid, sig);
+}
+
+/* Reap everything that has exited and queue an event for each of our
+ * jobs. Children we did not start are reaped and forgotten. */
+static void
+reap_jobs(void)
+{
+	struct rc_job *job;
+	struct rc_job_event *ev;
+	struct timespec now;
+	pid_t pid;
+	int status;
+
+	while ((pid = waitpid(-1, &status, WNOHANG)) != 0) {
+		if (pid == -1) {
+			if (errno == EINTR)
+				continue;
+			if (errno != ECHILD)
+				eerror("waitpid: %s", strerror(errno));
+			break;
+		}
+		LIST_FOREACH(job, job_bucket(pid), entries)
+			if (job->pid == pid)
+				break;
+		if (job == NULL)
+			continue;
+
+		LIST_REMOVE(job, entries);
+		njobs--;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		ev = xmalloc(sizeof(*ev));
+		ev->done.pid = pid;
+		ev->done.service = job->service;
+		ev->done.status = status;
+		timespecsub(&now, &job->start, &ev->done.elapsed);
+		TAILQ_INSERT_TAIL(&events, ev, entries);
+		free(job);
+	}
+}
+
+/* Wait up to timeout milliseconds, or forever if negative, for one of
+ * our jobs to finish. Returns false on timeout or if nothing is running. */
+bool
+rc_jobs_wait(struct rc_job_done *done, int timeout)
+{
+	struct rc_job_event *ev;
+	struct pollfd pfd;
+	char buf[64];
+	int n;
+
+	for (;;) {
+		reap_jobs();
+		if ((ev = TAILQ_FIRST(&events))) {
+			TAILQ_REMOVE(&events, ev, entries);
+			*done = ev->done;
+			free(ev);
+			return true;
+		}
+		if (njobs == 0)
+			return false;
+
+		pfd.fd = job_pipe[0];
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+		n = poll(&pfd, 1, timeout);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			eerrorx("poll: %s", strerror(errno));
+		}
+		if (n == 0)
+			return false;
+		while (read(job_pipe[0], buf, sizeof(buf)) > 0)
+			;
+	}
+}
+
+void
+rc_jobs_wait_all(void)
+{
+	struct rc_job_done done;
+
+	while (rc_jobs_wait(&done, -1))
+		free(done.service);
+}
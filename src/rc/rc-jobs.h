@@ -0,0 +1,39 @@
+/*
+ * rc-jobs.h
+ * Track the service scripts we have forked and report when they finish.
+ */
+
+/*
+ * Copyright (c) 2007-2015 The OpenRC Authors.
+ * See the Authors file at the top-level directory of this distribution and
+ * https://github.com/OpenRC/openrc/blob/master/AUTHORS
+ *
+ * This file is part of OpenRC. It is subject to the license terms in
+ * the LICENSE file found in the top-level directory of this
+ * distribution and at https://github.com/OpenRC/openrc/blob/master/LICENSE
+ * This file may not be copied, modified, propagated, or distributed
+ *    except according to the terms contained in the LICENSE file.
+ */
+
+#ifndef RC_JOBS_H
+#define RC_JOBS_H
+
+/* A finished job. The caller owns service and should free it. */
+struct rc_job_done {
+	pid_t pid;
+	char *service;
+	int status;
+	struct timespec elapsed;
+};
+
+void rc_jobs_init(void);
+void rc_jobs_free(void);
+/* Called from our SIGCHLD handler, so must be async signal safe. */
+void rc_jobs_sigchld(void);
+void rc_jobs_add(pid_t pid, const char *service);
+size_t rc_jobs_running(void);
+void rc_jobs_signal(int sig);
+bool rc_jobs_wait(struct rc_job_done *done, int timeout);
+void rc_jobs_wait_all(void);
+
+#endif
@@ -18,15 +18,22 @@
 #include <sys/file.h>
 #include <sys/types.h>
 #include <sys/utsname.h>
+#include <sys/wait.h>
 
 #ifdef __linux__
+#  include <dirent.h>
+#  include <sys/inotify.h>
+#  include <sys/syscall.h>
 #  include <sys/sysinfo.h>
 #endif
 
 #include <sys/time.h>
 #include <ctype.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <libgen.h>
 #include <limits.h>
+#include <poll.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -43,6 +50,10 @@
 
 extern char **environ;
 
+#ifndef CLOSE_RANGE_CLOEXEC
+#  define CLOSE_RANGE_CLOEXEC	(1U << 2)
+#endif
+
 bool
 rc_conf_yesno(const char *setting)
 {
@@ -355,7 +366,10 @@ is_writable(const char *path)
 	return 0;
 }
 
-RC_DEPTREE * _rc_deptree_load(int force, int *regen)
+/* Bring the deptree cache up to date if we can.
+ * Returns false if it was updated but cannot be used. */
+static bool
+deptree_refresh(int force, int *regen)
 {
 	int fd;
 	int retval;
@@ -374,7 +388,7 @@ RC_DEPTREE * _rc_deptree_load(int force, int *regen)
 		merrno = errno;
 		errno = serrno;
 		if (fd == -1 && merrno == EACCES)
-			return rc_deptree_load();
+			return true;
 		close(fd);
 
 		if (regen)
@@ -386,7 +400,7 @@ RC_DEPTREE * _rc_deptree_load(int force, int *regen)
 		if (retval == 0) {
 			if (stat(RC_DEPTREE_CACHE, &st) != 0) {
 				eerror("stat(%s): %s", RC_DEPTREE_CACHE, strerror(errno));
-				return NULL;
+				return false;
 			}
 			if (st.st_mtime < t) {
 				eerror("Clock skew detected with `%s'", file);
@@ -408,9 +422,32 @@ RC_DEPTREE * _rc_deptree_load(int force, int *regen)
 		if (force == -1 && regen != NULL)
 			*regen = retval;
 	}
+	return true;
+}
+
+RC_DEPTREE * _rc_deptree_load(int force, int *regen)
+{
+	if (!deptree_refresh(force, regen))
+		return NULL;
 	return rc_deptree_load();
 }
 
+/* Load the part of the deptree a service can reach when it starts or
+ * stops, falling back to all of it if that was not saved. */
+RC_DEPTREE *
+_rc_deptree_load_service(const char *service)
+{
+	RC_DEPTREE *deptree;
+	char *file;
+
+	if (!deptree_refresh(0, NULL))
+		return NULL;
+	xasprintf(&file, RC_DEPTREE_SERVICES "/%s", service);
+	deptree = rc_deptree_load_file(file);
+	free(file);
+	return deptree ? deptree : rc_deptree_load();
+}
+
 static const struct {
 	const char * const name;
 	RC_SERVICE bit;
@@ -490,3 +527,225 @@ pid_t get_pid(const char *applet,const char *pidfile)
 
 	return pid;
 }
+
+/* Returns the pid in pidfile if that process is running, otherwise -1 */
+static pid_t
+live_pid(const char *pidfile)
+{
+	FILE *fp;
+	pid_t pid;
+
+	if (!(fp = fopen(pidfile, "re")))
+		return -1;
+	if (fscanf(fp, "%d", &pid) != 1 || pid < 1)
+		pid = -1;
+	fclose(fp);
+	if (pid > 0 && kill(pid, 0) == -1 && errno != EPERM)
+		pid = -1;
+	return pid;
+}
+
+/* kill cannot tell a zombie from a running process, but for our own
+ * child waitpid can */
+static bool
+pid_running(pid_t pid, bool child)
+{
+	if (child)
+		return waitpid(pid, NULL, WNOHANG) == 0;
+	return kill(pid, 0) == 0 || errno == EPERM;
+}
+
+/*
+ * Waits up to timeout milliseconds for pidfile to name a running process
+ * and returns it, or -1. We look again whenever something changes in the
+ * directory holding pidfile, or every 20ms where inotify cannot tell us.
+ * If child is not 0 we give up early when that process, which must be
+ * ours, has exited.
+ */
+pid_t
+get_pid_wait(const char *applet, const char *pidfile, int timeout,
+    pid_t child)
+{
+	struct pollfd pfd;
+	struct timespec now, end;
+	pid_t pid;
+	int ms, slice = 20;
+#ifdef __linux__
+	char *dir;
+	char buf[sizeof(struct inotify_event) + NAME_MAX + 1];
+#endif
+
+	pfd.fd = -1;
+	pfd.events = POLLIN;
+#ifdef __linux__
+	/* Watch first so a write between looking and waiting is not lost */
+	dir = xstrdup(pidfile);
+	if ((pfd.fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) != -1 &&
+	    inotify_add_watch(pfd.fd, dirname(dir), IN_CLOSE_WRITE |
+	    IN_MODIFY | IN_MOVED_TO | IN_ONLYDIR) != -1)
+		slice = child > 0 ? 100 : -1;
+	else if (pfd.fd != -1) {
+		close(pfd.fd);
+		pfd.fd = -1;
+	}
+	free(dir);
+#endif
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	end.tv_sec += timeout / 1000;
+	end.tv_nsec += (timeout % 1000) * 1000000L;
+	if (end.tv_nsec >= 1000000000L) {
+		end.tv_sec++;
+		end.tv_nsec -= 1000000000L;
+	}
+
+	while ((pid = live_pid(pidfile)) == -1) {
+		if (child > 0 && !pid_running(child, true))
+			break;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		ms = (end.tv_sec - now.tv_sec) * 1000 +
+		    (end.tv_nsec - now.tv_nsec) / 1000000L;
+		if (ms <= 0)
+			break;
+		if (slice != -1 && ms > slice)
+			ms = slice;
+		if (poll(&pfd, pfd.fd == -1 ? 0 : 1, ms) == -1 &&
+		    errno != EINTR)
+		{
+			ewarnv("%s: poll: %s", applet, strerror(errno));
+			break;
+		}
+#ifdef __linux__
+		/* We only want to know that something happened */
+		if (pfd.fd != -1)
+			while (read(pfd.fd, buf, sizeof(buf)) > 0)
+				;
+#endif
+	}
+
+	if (pfd.fd != -1)
+		close(pfd.fd);
+	return pid;
+}
+
+/*
+ * Watches pid for up to timeout milliseconds. Returns false as soon as it
+ * exits, or true if it is still running at the end. A pidfd wakes us the
+ * moment the process exits, zombie or not. Without one we look every 20ms.
+ * Set child if pid is ours to reap.
+ */
+bool
+pid_alive_for(pid_t pid, int timeout, bool child)
+{
+	struct pollfd pfd;
+	struct timespec now, end;
+	int ms, r;
+	bool alive = false;
+
+	pfd.fd = -1;
+	pfd.events = POLLIN;
+#ifdef SYS_pidfd_open
+	pfd.fd = syscall(SYS_pidfd_open, pid, 0);
+	if (pfd.fd == -1 && errno == ESRCH)
+		return false;
+#endif
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	end.tv_sec += timeout / 1000;
+	end.tv_nsec += (timeout % 1000) * 1000000L;
+	if (end.tv_nsec >= 1000000000L) {
+		end.tv_sec++;
+		end.tv_nsec -= 1000000000L;
+	}
+
+	for (;;) {
+		if (pfd.fd == -1 && !pid_running(pid, child))
+			break;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		ms = (end.tv_sec - now.tv_sec) * 1000 +
+		    (end.tv_nsec - now.tv_nsec) / 1000000L;
+		if (ms < 0)
+			ms = 0;
+		if (pfd.fd == -1 && ms > 20)
+			ms = 20;
+		r = poll(&pfd, pfd.fd == -1 ? 0 : 1, ms);
+		/* A readable pidfd means the process has exited */
+		if (r > 0)
+			break;
+		if (r == -1 && errno != EINTR && pfd.fd != -1) {
+			close(pfd.fd);
+			pfd.fd = -1;
+		}
+		if (r == 0 && ms == 0 && (pfd.fd != -1 ||
+		    pid_running(pid, child))) {
+			alive = true;
+			break;
+		}
+	}
+
+	if (pfd.fd != -1)
+		close(pfd.fd);
+	return alive;
+}
+
+static void
+close_fd(int fd, bool cloexec)
+{
+	if (cloexec)
+		fcntl(fd, F_SETFD, FD_CLOEXEC);
+	else
+		close(fd);
+}
+
+#ifdef __linux__
+/* Only the fds we really have open */
+static bool
+close_proc_fds(int first, int last, bool cloexec)
+{
+	DIR *dp;
+	struct dirent *d;
+	char *end;
+	long fd;
+
+	if (!(dp = opendir("/proc/self/fd")))
+		return false;
+	while ((d = readdir(dp))) {
+		fd = strtol(d->d_name, &end, 10);
+		if (*end || end == d->d_name || fd == dirfd(dp) ||
+		    fd < first || (last != -1 && fd > last))
+			continue;
+		close_fd(fd, cloexec);
+	}
+	closedir(dp);
+	return true;
+}
+#endif
+
+/*
+ * Closes, or marks close-on-exec, every fd from first to last, or to the
+ * end if last is -1. With a high RLIMIT_NOFILE a loop to getdtablesize()
+ * is a lot of syscalls for the handful of fds we have, so ask the kernel
+ * to do the range or look at the ones that are really open.
+ */
+void
+close_fds(int first, int last, bool cloexec)
+{
+	int i;
+
+	if (last != -1 && last < first)
+		return;
+#ifdef SYS_close_range
+	if (syscall(SYS_close_range, (unsigned int)first,
+	    last == -1 ? ~0U : (unsigned int)last,
+	    cloexec ? CLOSE_RANGE_CLOEXEC : 0) == 0)
+		return;
+#endif
+#ifdef __linux__
+	if (close_proc_fds(first, last, cloexec))
+		return;
+#endif
+	if (last == -1)
+		last = getdtablesize() - 1;
+	for (i = first; i <= last; i++)
+		close_fd(i, cloexec);
+}
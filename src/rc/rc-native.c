@@ -0,0 +1,919 @@
+/*
+ * rc-native.c
+ * Start and stop simple services without openrc-run.sh.
+ *
+ * Most services only set command, pidfile and a few other variables and
+ * leave starting and stopping to start-stop-daemon or supervise-daemon.
+ * For those we ask openrc-run.sh once to evaluate the service and print
+ * its settings, and keep them in RC_SVCDIR/native along with a key made
+ * from the script and every configuration file it sourced. While the key
+ * matches we build the daemon command line ourselves, so starting the
+ * service is one fork and exec.
+ * Services which define their own start, stop or hook functions, or use
+ * settings we do not handle here, are recorded as needing the shell.
+ */
+
+/*
+ * Copyright (c) 2007-2015 The OpenRC Authors.
+ * See the Authors file at the top-level directory of this distribution and
+ * https://github.com/OpenRC/openrc/blob/master/AUTHORS
+ *
+ * This file is part of OpenRC. It is subject to the license terms in
+ * the LICENSE file found in the top-level directory of this
+ * distribution and at https://github.com/OpenRC/openrc/blob/master/LICENSE
+ * This file may not be copied, modified, propagated, or distributed
+ *    except according to the terms contained in the LICENSE file.
+ */
+
+#include <sys/types.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "einfo.h"
+#include "queue.h"
+#include "rc.h"
+#include "rc-config.h"
+#include "rc-misc.h"
+#include "rc-native.h"
+
+#define RC_NATIVE_DIR	RC_SVCDIR "/native"
+
+/* Functions which mean the service needs the shell to start or stop,
+ * including the launcher functions of the modules we stand in for */
+static const char *const hooks[] = {
+	"start", "stop", "start_pre", "start_post", "stop_pre", "stop_post",
+	"ssd_start", "ssd_stop", "supervise_start", "supervise_stop",
+};
+
+/* Settings we leave to the shell */
+static const char *const shell_only[] = {
+	"output_logger", "error_logger", "in_background_fake", "opts",
+};
+
+/* Settings the shell word splits into a list of paths */
+static const char *const lists[] = {
+	"required_dirs", "required_files",
+};
+
+/* What ulimit can set, and the unit it takes each in. The block size of
+ * -c and -f depends on the shell, so we only take 0 or unlimited there. */
+static const struct {
+	char opt;
+	int resource;
+	rlim_t unit;
+} ulimits[] = {
+	{ 't', RLIMIT_CPU,	1 },
+	{ 'f', RLIMIT_FSIZE,	0 },
+	{ 'd', RLIMIT_DATA,	1024 },
+	{ 's', RLIMIT_STACK,	1024 },
+	{ 'c', RLIMIT_CORE,	0 },
+	{ 'n', RLIMIT_NOFILE,	1 },
+#ifdef RLIMIT_RSS
+	{ 'm', RLIMIT_RSS,	1024 },
+#endif
+#ifdef RLIMIT_MEMLOCK
+	{ 'l', RLIMIT_MEMLOCK,	1024 },
+#endif
+#ifdef RLIMIT_NPROC
+	{ 'u', RLIMIT_NPROC,	1 },
+#endif
+#ifdef RLIMIT_AS
+	{ 'v', RLIMIT_AS,	1024 },
+#endif
+#ifdef RLIMIT_NICE
+	{ 'e', RLIMIT_NICE,	1 },
+#endif
+#ifdef RLIMIT_RTPRIO
+	{ 'r', RLIMIT_RTPRIO,	1 },
+#endif
+};
+
+/* Settings the shell word splits when building the daemon command */
+static const char *const words[] = {
+	"command", "pidfile", "procname", "chroot", "directory", "umask",
+	"output_log", "error_log", "command_user", "retry", "stopsig",
+	"respawn_delay", "respawn_max", "respawn_period", "notify",
+	"notify_timeout",
+};
+
+/* Settings passed to the daemon whenever they are set, even if empty */
+static const char *const set_only[] = {
+	"output_log", "error_log", "command_user", "umask",
+};
+
+/* Variables the shell exports which the daemon should not see changed */
+static const char *const env_skip[] = {
+	"_", "OLDPWD", "PWD", "RC_CMD", "SHLVL",
+};
+
+static const char *
+runsh(void)
+{
+	if (exists(RC_SVCDIR "/openrc-run.sh"))
+		return RC_SVCDIR "/openrc-run.sh";
+	return RC_LIBEXECDIR "/sh/openrc-run.sh";
+}
+
+static char *
+native_key(const char *script, const char *svcname, const char *runlevel)
+{
+	uint64_t hash = FNV_OFFSET;
+	char *key;
+
+	key = rc_config_key(script, svcname, runlevel);
+	hash_string(&hash, key);
+	free(key);
+	hash_stat(&hash, runsh());
+	hash_stat(&hash, script);
+
+	xasprintf(&key, "%016llx", (unsigned long long)hash);
+	return key;
+}
+
+/* Does the file define a function which means we need the shell? */
+static bool
+defines_hook(const char *file)
+{
+	FILE *fp;
+	char *line = NULL, *p, *name;
+	size_t len = 0, n, i;
+	bool found = false;
+
+	if (!(fp = fopen(file, "r")))
+		return false;
+	while (!found && getline(&line, &len, fp) != -1) {
+		p = line + strspn(line, " \t");
+		if (strncmp(p, "function", 8) == 0 &&
+		    isspace((unsigned char)p[8]))
+			p += 8 + strspn(p + 8, " \t");
+		name = p;
+		for (n = 0; isalnum((unsigned char)p[n]) || p[n] == '_'; n++)
+			;
+		if (n == 0)
+			continue;
+		p += n;
+		p += strspn(p, " \t");
+		if (*p != '(')
+			continue;
+		for (i = 0; i < ARRAY_SIZE(hooks); i++)
+			if (strlen(hooks[i]) == n &&
+			    strncmp(name, hooks[i], n) == 0)
+				found = true;
+	}
+	free(line);
+	fclose(fp);
+	return found;
+}
+
+static struct rc_native *
+native_new(void)
+{
+	struct rc_native *n = xmalloc(sizeof(*n));
+
+	memset(n, 0, sizeof(*n));
+	n->funcs = rc_stringlist_new();
+	n->vars = rc_stringlist_new();
+	n->bgargs = rc_stringlist_new();
+	n->fgargs = rc_stringlist_new();
+	n->ssdargs = rc_stringlist_new();
+	n->sdargs = rc_stringlist_new();
+	n->env = rc_stringlist_new();
+	return n;
+}
+
+static RC_STRINGLIST *
+record_list(struct rc_native *n, const char *type)
+{
+	if (strcmp(type, "func") == 0)
+		return n->funcs;
+	if (strcmp(type, "var") == 0)
+		return n->vars;
+	if (strcmp(type, "bgarg") == 0)
+		return n->bgargs;
+	if (strcmp(type, "fgarg") == 0)
+		return n->fgargs;
+	if (strcmp(type, "ssdarg") == 0)
+		return n->ssdargs;
+	if (strcmp(type, "sdarg") == 0)
+		return n->sdargs;
+	if (strcmp(type, "env") == 0)
+		return n->env;
+	return NULL;
+}
+
+/* Did the shell export a variable or change one we already had? */
+static bool
+env_changed(const char *entry)
+{
+	char *name = xstrdup(entry);
+	char *value = strchr(name, '=');
+	const char *cur;
+	bool changed = false;
+	size_t i;
+
+	if (value) {
+		*value++ = '\0';
+		cur = getenv(name);
+		changed = !cur || strcmp(cur, value) != 0;
+		for (i = 0; changed && i < ARRAY_SIZE(env_skip); i++)
+			if (strcmp(name, env_skip[i]) == 0)
+				changed = false;
+	}
+	free(name);
+	return changed;
+}
+
+/* Run openrc-run.sh to print the settings of the service.
+ * The output is a list of type=value records, each ending in a NUL,
+ * followed by an env record and the exported environment. */
+static bool
+generate(struct rc_native *n, const char *script)
+{
+	struct sigaction sa, osa;
+	RC_STRINGLIST *list;
+	FILE *fp;
+	char *rec = NULL, *val;
+	size_t len = 0;
+	bool env = false, ok = true;
+	int fds[2], status = -1;
+	pid_t pid;
+
+	if (pipe(fds) == -1)
+		return false;
+
+	/* Our SIGCHLD handler would reap the shell before we can */
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = SIG_DFL;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGCHLD, &sa, &osa);
+
+	if ((pid = fork()) == -1) {
+		close(fds[0]);
+		close(fds[1]);
+		sigaction(SIGCHLD, &osa, NULL);
+		return false;
+	}
+	if (pid == 0) {
+		close(fds[0]);
+		dup2(fds[1], STDOUT_FILENO);
+		close(fds[1]);
+		execl(runsh(), runsh(), script, "_native", (char *) NULL);
+		_exit(EXIT_FAILURE);
+	}
+
+	close(fds[1]);
+	if (!(fp = fdopen(fds[0], "r"))) {
+		close(fds[0]);
+		ok = false;
+	} else {
+		while (getdelim(&rec, &len, '\0', fp) != -1) {
+			if (env) {
+				if (env_changed(rec))
+					rc_stringlist_add(n->env, rec);
+				continue;
+			}
+			if (strcmp(rec, "env") == 0) {
+				env = true;
+				continue;
+			}
+			if (!(val = strchr(rec, '='))) {
+				ok = false;
+				continue;
+			}
+			*val++ = '\0';
+			if ((list = record_list(n, rec)) && list != n->env)
+				rc_stringlist_add(list, val);
+			else
+				ok = false;
+		}
+		free(rec);
+		fclose(fp);
+	}
+
+	while (waitpid(pid, &status, 0) == -1 && errno == EINTR)
+		;
+	sigaction(SIGCHLD, &osa, NULL);
+
+	return ok && env && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+/* Characters the shell would do something with */
+static const char shell_special[] = " \t\n\"'`$\\*?[;&|<>{}()~#";
+
+static bool
+plain(const char *value)
+{
+	return strpbrk(value, shell_special) == NULL;
+}
+
+static bool
+plain_list(const char *value)
+{
+	return strpbrk(value, "\"'`$\\*?[;&|<>{}()~#") == NULL;
+}
+
+/* Parse rc_ulimit as the shell's ulimit would, and set the limit unless
+ * we only check. We take a single limit with an optional -H or -S and
+ * leave anything else to the shell. */
+static bool
+ulimit_set(const char *spec, bool check)
+{
+	char *copy, *p, *word, *c, *end;
+	bool hard = false, soft = false, ok = false;
+	size_t i, r = ARRAY_SIZE(ulimits);
+	const char *value = NULL;
+	unsigned long long v;
+	rlim_t limit;
+	struct rlimit rl;
+
+	p = copy = xstrdup(spec);
+	while ((word = strsep(&p, " \t\n"))) {
+		if (!*word)
+			continue;
+		if (*word != '-' || !word[1]) {
+			if (value)
+				goto out;
+			value = spec + (word - copy);
+			continue;
+		}
+		if (value)
+			goto out;
+		for (c = word + 1; *c; c++) {
+			if (*c == 'H')
+				hard = true;
+			else if (*c == 'S')
+				soft = true;
+			else {
+				if (r != ARRAY_SIZE(ulimits))
+					goto out;
+				for (r = 0; r < ARRAY_SIZE(ulimits); r++)
+					if (ulimits[r].opt == *c)
+						break;
+				if (r == ARRAY_SIZE(ulimits))
+					goto out;
+			}
+		}
+	}
+	if (r == ARRAY_SIZE(ulimits) || !value)
+		goto out;
+
+	i = strcspn(value, " \t\n");
+	if (strncmp(value, "unlimited", i) == 0 && i == 9)
+		limit = RLIM_INFINITY;
+	else {
+		if (!isdigit((unsigned char)*value))
+			goto out;
+		errno = 0;
+		v = strtoull(value, &end, 10);
+		if (errno || (size_t)(end - value) != i)
+			goto out;
+		if (ulimits[r].unit == 0) {
+			if (v != 0)
+				goto out;
+			limit = 0;
+		} else {
+			limit = (rlim_t)v * ulimits[r].unit;
+			if (limit / ulimits[r].unit != v ||
+			    limit == RLIM_INFINITY)
+				goto out;
+		}
+	}
+	ok = true;
+	if (check)
+		goto out;
+
+	/* Like the shell, failing to set it is not fatal */
+	if (!hard && !soft)
+		hard = soft = true;
+	if (getrlimit(ulimits[r].resource, &rl) == 0) {
+		if (soft)
+			rl.rlim_cur = limit;
+		if (hard)
+			rl.rlim_max = limit;
+		if (setrlimit(ulimits[r].resource, &rl) == 0)
+			goto out;
+	}
+	fprintf(stderr, "ulimit: error setting limit (%s)\n", strerror(errno));
+
+out:
+	free(copy);
+	return ok;
+}
+
+/* rc_ulimit, or RC_ULIMIT if the service does not set it */
+static const char *
+native_ulimit(const struct rc_native *n)
+{
+	const char *v;
+
+	if ((v = rc_native_value(n, "rc_ulimit")) && *v)
+		return v;
+	if ((v = rc_native_value(n, "RC_ULIMIT")) && *v)
+		return v;
+	return NULL;
+}
+
+/* Can we start and stop this service without the shell? */
+static bool
+native_check(struct rc_native *n, const char *script, RC_STRINGLIST *confs)
+{
+	RC_STRING *s;
+	const char *v;
+	size_t i;
+
+	if (TAILQ_FIRST(n->funcs) || defines_hook(script))
+		return false;
+	TAILQ_FOREACH(s, confs, entries)
+		if (defines_hook(s->value))
+			return false;
+	/* Our key only knows the script and its configuration changed, so
+	 * what they assign must not come from commands or other files */
+	if (!rc_config_plain(script, true))
+		return false;
+	TAILQ_FOREACH(s, confs, entries)
+		if (!rc_config_plain(s->value, false))
+			return false;
+
+	for (i = 0; i < ARRAY_SIZE(shell_only); i++)
+		if ((v = rc_native_value(n, shell_only[i])) && *v)
+			return false;
+	for (i = 0; i < ARRAY_SIZE(words); i++)
+		if ((v = rc_native_value(n, words[i])) && !plain(v))
+			return false;
+	for (i = 0; i < ARRAY_SIZE(set_only); i++)
+		if ((v = rc_native_value(n, set_only[i])) && !*v)
+			return false;
+	for (i = 0; i < ARRAY_SIZE(lists); i++)
+		if ((v = rc_native_value(n, lists[i])) && !plain_list(v))
+			return false;
+	if ((v = native_ulimit(n)) && !ulimit_set(v, true))
+		return false;
+	if (rc_yesno(rc_native_value(n, "start_inactive")) ||
+	    rc_yesno(rc_native_value(n, "rc_cgroup_cleanup")))
+		return false;
+
+	if ((v = rc_native_value(n, "supervisor")) && *v &&
+	    strcmp(v, "supervise-daemon") != 0)
+		return false;
+	if (!(v = rc_native_value(n, "command")) || !*v)
+		return false;
+	if (rc_yesno(rc_native_value(n, "command_background")) &&
+	    (!(v = rc_native_value(n, "supervisor")) || !*v))
+	{
+		if (!(v = rc_native_value(n, "pidfile")) || !*v)
+			return false;
+		if ((v = rc_native_value(n, "command_args_background")) && *v)
+			return false;
+	}
+	return true;
+}
+
+static struct rc_native *
+native_read(const char *file, const char *key)
+{
+	struct rc_native *n;
+	RC_STRINGLIST *list;
+	FILE *fp;
+	char *rec = NULL, *val;
+	size_t len = 0;
+	bool valid = false;
+
+	if (!(fp = fopen(file, "r")))
+		return NULL;
+	n = native_new();
+	while (getdelim(&rec, &len, '\0', fp) != -1) {
+		if (!(val = strchr(rec, '='))) {
+			valid = false;
+			break;
+		}
+		*val++ = '\0';
+		if (strcmp(rec, "key") == 0)
+			valid = strcmp(val, key) == 0;
+		else if (!valid)
+			break;
+		else if (strcmp(rec, "native") == 0)
+			n->native = rc_yesno(val);
+		else if ((list = record_list(n, rec)))
+			rc_stringlist_add(list, val);
+		else
+			valid = false;
+		if (!valid)
+			break;
+	}
+	free(rec);
+	fclose(fp);
+
+	if (!valid) {
+		rc_native_free(n);
+		return NULL;
+	}
+	return n;
+}
+
+static void
+write_list(FILE *fp, const char *type, RC_STRINGLIST *list)
+{
+	RC_STRING *s;
+
+	TAILQ_FOREACH(s, list, entries)
+		fprintf(fp, "%s=%s%c", type, s->value, '\0');
+}
+
+static void
+native_write(const struct rc_native *n, const char *file, const char *key)
+{
+	FILE *fp;
+	char *tmp = NULL;
+	int fd;
+
+	/* The evaluated settings may hold secrets from a 0600 conf.d */
+	xasprintf(&tmp, "%s.%d", file, (int) getpid());
+	if ((fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+	    0600)) == -1)
+	{
+		free(tmp);
+		return;
+	}
+	if (!(fp = fdopen(fd, "w"))) {
+		close(fd);
+		unlink(tmp);
+		free(tmp);
+		return;
+	}
+	fprintf(fp, "key=%s%c", key, '\0');
+	fprintf(fp, "native=%s%c", n->native ? "YES" : "NO", '\0');
+	if (n->native) {
+		write_list(fp, "func", n->funcs);
+		write_list(fp, "var", n->vars);
+		write_list(fp, "bgarg", n->bgargs);
+		write_list(fp, "fgarg", n->fgargs);
+		write_list(fp, "ssdarg", n->ssdargs);
+		write_list(fp, "sdarg", n->sdargs);
+		write_list(fp, "env", n->env);
+	}
+	if (fclose(fp) == 0 && rename(tmp, file) == 0) {
+		free(tmp);
+		return;
+	}
+	unlink(tmp);
+	free(tmp);
+}
+
+/* Work out the cgroup openrc-run.sh would put the service in.
+ * Returns false when only the shell can set up the cgroups. */
+static bool
+native_cgroup(struct rc_native *n, const char *svcname)
+{
+	const char *sys = getenv("RC_SYS");
+	char *tasks;
+	DIR *dp;
+	struct dirent *d;
+	struct stat st;
+	bool v1 = false;
+
+	if (sys && (strcmp(sys, "PREFIX") == 0 ||
+		strcmp(sys, "SYSTEMD-NSPAWN") == 0))
+		return true;
+	if (!exists(RC_LIBEXECDIR "/sh/rc-cgroup.sh"))
+		return true;
+
+	if (stat("/sys/fs/cgroup", &st) == 0 && S_ISDIR(st.st_mode) &&
+	    access("/sys/fs/cgroup", W_OK) != 0)
+		return false;
+	if ((dp = opendir("/sys/fs/cgroup"))) {
+		while (!v1 && (d = readdir(dp))) {
+			if (d->d_name[0] == '.')
+				continue;
+			xasprintf(&tasks, "/sys/fs/cgroup/%s/tasks", d->d_name);
+			v1 = access(tasks, W_OK) == 0;
+			free(tasks);
+		}
+		closedir(dp);
+	}
+	if (v1)
+		return false;
+
+	n->cgroup = rc_cgroup_dir(svcname, rc_native_value(n, "rc_cgroup_mode"));
+	return true;
+}
+
+struct rc_native *
+rc_native_load(const char *script, const char *svcname, const char *runlevel)
+{
+	struct rc_native *n;
+	RC_STRINGLIST *confs;
+	const char *v;
+	char *key, *file = NULL;
+
+	/* openrc-run.sh has these to deal with first */
+	if (rc_yesno(getenv("RC_DEBUG")) ||
+	    exists("/sbin/livecd-functions.sh") ||
+	    !exists(RC_SVCDIR "/softlevel"))
+		return NULL;
+
+	if (!runlevel)
+		runlevel = "";
+	confs = rc_config_files(script, svcname, runlevel);
+	key = native_key(script, svcname, runlevel);
+	xasprintf(&file, RC_NATIVE_DIR "/%s", svcname);
+	if (!(n = native_read(file, key))) {
+		n = native_new();
+		n->native = generate(n, script) && native_check(n, script, confs);
+		if (mkdir(RC_NATIVE_DIR, 0700) == 0 || errno == EEXIST)
+			native_write(n, file, key);
+	}
+	free(file);
+	free(key);
+	rc_stringlist_free(confs);
+
+	if (n->native) {
+		v = rc_native_value(n, "supervisor");
+		n->supervised = v && strcmp(v, "supervise-daemon") == 0;
+		n->native = native_cgroup(n, svcname);
+	}
+	if (!n->native) {
+		rc_native_free(n);
+		return NULL;
+	}
+	return n;
+}
+
+/* The value of a variable, or NULL if the service did not set it */
+const char *
+rc_native_value(const struct rc_native *n, const char *var)
+{
+	RC_STRING *s;
+	size_t len = strlen(var);
+
+	TAILQ_FOREACH(s, n->vars, entries)
+		if (strncmp(s->value, var, len) == 0 && s->value[len] == '=')
+			return s->value + len + 1;
+	return NULL;
+}
+
+static void
+new_args(struct rc_native *n)
+{
+	rc_stringlist_free(n->args);
+	free(n->argv);
+	n->args = rc_stringlist_new();
+	n->argv = NULL;
+}
+
+static void
+add_value(struct rc_native *n, const char *opt, const char *value)
+{
+	if (value && *value) {
+		rc_stringlist_add(n->args, opt);
+		rc_stringlist_add(n->args, value);
+	}
+}
+
+static void
+add_var(struct rc_native *n, const char *opt, const char *var)
+{
+	add_value(n, opt, rc_native_value(n, var));
+}
+
+static void
+add_list(struct rc_native *n, RC_STRINGLIST *list)
+{
+	RC_STRING *s;
+
+	TAILQ_FOREACH(s, list, entries)
+		rc_stringlist_add(n->args, s->value);
+}
+
+static char **
+make_argv(struct rc_native *n)
+{
+	RC_STRING *s;
+	size_t i = 0;
+
+	TAILQ_FOREACH(s, n->args, entries)
+		i++;
+	n->argv = xmalloc(sizeof(char *) * (i + 1));
+	i = 0;
+	TAILQ_FOREACH(s, n->args, entries)
+		n->argv[i++] = s->value;
+	n->argv[i] = NULL;
+	return n->argv;
+}
+
+/* Build the command ssd_start or supervise_start would run */
+char **
+rc_native_start(struct rc_native *n, const char *svcname)
+{
+	new_args(n);
+	if (n->supervised) {
+		rc_stringlist_add(n->args, "supervise-daemon");
+		rc_stringlist_add(n->args, svcname);
+		rc_stringlist_add(n->args, "--start");
+		add_var(n, "--retry", "retry");
+		add_var(n, "--chdir", "directory");
+		add_var(n, "--chroot", "chroot");
+		add_var(n, "--stdout", "output_log");
+		add_var(n, "--stderr", "error_log");
+		add_var(n, "--pidfile", "pidfile");
+		add_var(n, "--respawn-delay", "respawn_delay");
+		add_var(n, "--respawn-max", "respawn_max");
+		add_var(n, "--respawn-period", "respawn_period");
+		add_var(n, "--user", "command_user");
+		add_var(n, "--umask", "umask");
+		add_var(n, "--notify", "notify");
+		add_var(n, "--notify-timeout", "notify_timeout");
+		add_list(n, n->sdargs);
+		rc_stringlist_add(n->args, rc_native_value(n, "command"));
+		rc_stringlist_add(n->args, "--");
+		add_list(n, n->fgargs);
+	} else {
+		rc_stringlist_add(n->args, "start-stop-daemon");
+		rc_stringlist_add(n->args, "--start");
+		add_var(n, "--exec", "command");
+		add_var(n, "--chroot", "chroot");
+		add_var(n, "--chdir", "directory");
+		add_var(n, "--stdout", "output_log");
+		add_var(n, "--stderr", "error_log");
+		add_var(n, "--name", "procname");
+		add_var(n, "--pidfile", "pidfile");
+		add_var(n, "--user", "command_user");
+		add_var(n, "--umask", "umask");
+		add_var(n, "--notify", "notify");
+		add_var(n, "--notify-timeout", "notify_timeout");
+		if (rc_yesno(rc_native_value(n, "command_background"))) {
+			rc_stringlist_add(n->args, "--background");
+			rc_stringlist_add(n->args, "--make-pidfile");
+		}
+		add_list(n, n->ssdargs);
+		rc_stringlist_add(n->args, "--");
+		add_list(n, n->bgargs);
+	}
+	return make_argv(n);
+}
+
+/* Prefer the values we saved when the service started */
+static char *
+started_value(const struct rc_native *n, const char *svcname, const char *var)
+{
+	char *value = rc_service_value_get(svcname, var);
+
+	if (value && *value)
+		return value;
+	free(value);
+	return xstrdup(rc_native_value(n, var));
+}
+
+/* Build the command ssd_stop or supervise_stop would run.
+ * Returns NULL if there is nothing to stop. */
+char **
+rc_native_stop(struct rc_native *n, const char *svcname)
+{
+	char *command, *chroot, *pidfile, *procname, *path = NULL;
+
+	command = n->supervised ? NULL : started_value(n, svcname, "command");
+	chroot = started_value(n, svcname, "chroot");
+	pidfile = started_value(n, svcname, "pidfile");
+	procname = n->supervised ? NULL :
+	    started_value(n, svcname, "procname");
+	if (pidfile && *pidfile)
+		xasprintf(&path, "%s%s", chroot ? chroot : "", pidfile);
+
+	new_args(n);
+	if (n->supervised) {
+		if (path) {
+			rc_stringlist_add(n->args, "supervise-daemon");
+			rc_stringlist_add(n->args, svcname);
+			rc_stringlist_add(n->args, "--stop");
+			add_value(n, "--pidfile", path);
+			add_var(n, "--signal", "stopsig");
+		}
+	} else if ((command && *command) || (procname && *procname) || path) {
+		rc_stringlist_add(n->args, "start-stop-daemon");
+		rc_stringlist_add(n->args, "--stop");
+		add_var(n, "--retry", "retry");
+		add_value(n, "--exec", command);
+		add_value(n, "--name", procname);
+		add_value(n, "--pidfile", path);
+		add_var(n, "--signal", "stopsig");
+		if (rc_yesno(rc_native_value(n, "command_progress")))
+			rc_stringlist_add(n->args, "--progress");
+	}
+	free(command);
+	free(chroot);
+	free(pidfile);
+	free(procname);
+	free(path);
+
+	if (!TAILQ_FIRST(n->args))
+		return NULL;
+	return make_argv(n);
+}
+
+/* Check required_dirs and required_files as openrc-run.sh does.
+ * Returns false after saying what is missing. */
+bool
+rc_native_required(const struct rc_native *n, const char *svcname)
+{
+	char *copy, *p, *path;
+	const char *v;
+	struct stat st;
+	size_t i;
+	bool ok = true;
+
+	for (i = 0; ok && i < ARRAY_SIZE(lists); i++) {
+		if (!(v = rc_native_value(n, lists[i])) || !*v)
+			continue;
+		p = copy = xstrdup(v);
+		while (ok && (path = strsep(&p, " \t\n"))) {
+			if (!*path)
+				continue;
+			if (i == 0 && (fstatat(AT_FDCWD, path, &st, 0) == -1 ||
+			    !S_ISDIR(st.st_mode)))
+			{
+				eerror("%s: `%s' is not a directory",
+				    svcname, path);
+				ok = false;
+			} else if (i == 1 &&
+			    faccessat(AT_FDCWD, path, R_OK, AT_EACCESS) == -1)
+			{
+				eerror("%s: `%s' is not readable",
+				    svcname, path);
+				ok = false;
+			}
+		}
+		free(copy);
+	}
+	return ok;
+}
+
+/* Set rc_ulimit, in the child about to run the daemon */
+void
+rc_native_limits(const struct rc_native *n)
+{
+	const char *v;
+
+	if ((v = native_ulimit(n)))
+		ulimit_set(v, false);
+}
+
+/* Remember what we started so we can stop it even if the config changes */
+void
+rc_native_started(const struct rc_native *n, const char *svcname)
+{
+	static const char *const ssd_values[] = {
+		"chroot", "pidfile", "procname",
+	};
+	const char *v;
+	size_t i;
+
+	if (!n->supervised)
+		rc_service_value_set(svcname, "command",
+		    rc_native_value(n, "command"));
+	for (i = 0; i < ARRAY_SIZE(ssd_values); i++) {
+		if (n->supervised && strcmp(ssd_values[i], "procname") == 0)
+			continue;
+		if ((v = rc_native_value(n, ssd_values[i])) && *v)
+			rc_service_value_set(svcname, ssd_values[i], v);
+	}
+	if (n->cgroup)
+		rc_service_value_set(svcname, "cgroup", n->cgroup);
+}
+
+/* Remove the cgroup of a stopped service, as cgroup2_remove does */
+void
+rc_native_cgroup_remove(const struct rc_native *n)
+{
+	if (n->cgroup)
+		rc_cgroup_remove(n->cgroup);
+}
+
+void
+rc_native_free(struct rc_native *n)
+{
+	if (!n)
+		return;
+	rc_stringlist_free(n->funcs);
+	rc_stringlist_free(n->vars);
+	rc_stringlist_free(n->bgargs);
+	rc_stringlist_free(n->fgargs);
+	rc_stringlist_free(n->ssdargs);
+	rc_stringlist_free(n->sdargs);
+	rc_stringlist_free(n->env);
+	rc_stringlist_free(n->args);
+	free(n->argv);
+	free(n->cgroup);
+	free(n);
+}
@@ -0,0 +1,48 @@
+/*
+ * rc-native.h
+ * Start and stop simple services without openrc-run.sh.
+ */
+
+/*
+ * Copyright (c) 2007-2015 The OpenRC Authors.
+ * See the Authors file at the top-level directory of this distribution and
+ * https://github.com/OpenRC/openrc/blob/master/AUTHORS
+ *
+ * This file is part of OpenRC. It is subject to the license terms in
+ * the LICENSE file found in the top-level directory of this
+ * distribution and at https://github.com/OpenRC/openrc/blob/master/LICENSE
+ * This file may not be copied, modified, propagated, or distributed
+ *    except according to the terms contained in the LICENSE file.
+ */
+
+#ifndef RC_NATIVE_H
+#define RC_NATIVE_H
+
+/* The settings of a service as openrc-run.sh evaluated them. */
+struct rc_native {
+	bool native;
+	bool supervised;	/* supervisor="supervise-daemon" */
+	RC_STRINGLIST *funcs;	/* start_pre and friends, if defined */
+	RC_STRINGLIST *vars;	/* name=value for each variable set */
+	RC_STRINGLIST *bgargs;	/* command_args for start-stop-daemon */
+	RC_STRINGLIST *fgargs;	/* command_args for supervise-daemon */
+	RC_STRINGLIST *ssdargs;	/* start_stop_daemon_args */
+	RC_STRINGLIST *sdargs;	/* supervise_daemon_args */
+	RC_STRINGLIST *env;	/* variables the script exported */
+	RC_STRINGLIST *args;	/* the command we built last */
+	char **argv;
+	char *cgroup;		/* cgroup2 directory for the service */
+};
+
+struct rc_native *rc_native_load(const char *script, const char *svcname,
+    const char *runlevel);
+const char *rc_native_value(const struct rc_native *, const char *var);
+char **rc_native_start(struct rc_native *, const char *svcname);
+char **rc_native_stop(struct rc_native *, const char *svcname);
+bool rc_native_required(const struct rc_native *, const char *svcname);
+void rc_native_limits(const struct rc_native *);
+void rc_native_started(const struct rc_native *, const char *svcname);
+void rc_native_cgroup_remove(const struct rc_native *);
+void rc_native_free(struct rc_native *);
+
+#endif
@@ -0,0 +1,246 @@
+/*
+ * rc-notify.c
+ * Wait for a daemon to say it is ready.
+ *
+ * Two protocols are understood. With fd:N the daemon finds the write end
+ * of a pipe on fd N and writes a newline to it once it is ready, as s6
+ * daemons do. With socket the daemon finds an AF_UNIX datagram socket in
+ * NOTIFY_SOCKET and sends READY=1 to it, as sd_notify does.
+ * The socket lives in a 0700 directory belonging to the daemon's user, so
+ * nobody else can claim the daemon is ready.
+ */
+
+/*
+ * Copyright (c) 2018 The OpenRC Authors.
+ * See the Authors file at the top-level directory of this distribution and
+ * https://github.com/OpenRC/openrc/blob/master/AUTHORS
+ *
+ * This file is part of OpenRC. It is subject to the license terms in
+ * the LICENSE file found in the top-level directory of this
+ * distribution and at https://github.com/OpenRC/openrc/blob/master/LICENSE
+ * This file may not be copied, modified, propagated, or distributed
+ *    except according to the terms contained in the LICENSE file.
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "rc.h"
+#include "rc-notify.h"
+#include "helpers.h"
+
+/* How often we look for a daemon that died without a word */
+#define NOTIFY_PID_POLL	100
+
+bool
+rc_notify_parse(struct notify *n, const char *spec)
+{
+	char *end;
+	long target;
+
+	n->type = NOTIFY_NONE;
+	n->fd = n->child_fd = n->target = -1;
+	n->socket = n->dir = NULL;
+	n->owner = 0;
+	if (strncmp(spec, "fd:", 3) == 0) {
+		errno = 0;
+		target = strtol(spec + 3, &end, 10);
+		if (errno || end == spec + 3 || *end ||
+		    target < 3 || target > 1024)
+			return false;
+		n->type = NOTIFY_FD;
+		n->target = (int)target;
+		return true;
+	}
+	if (strcmp(spec, "socket") == 0) {
+		n->type = NOTIFY_SOCKET;
+		return true;
+	}
+	return false;
+}
+
+/* uid is the user the daemon will run as */
+bool
+rc_notify_open(struct notify *n, uid_t uid)
+{
+	int pfd[2];
+	static int count;
+	struct sockaddr_un sun;
+
+	switch (n->type) {
+	case NOTIFY_FD:
+		if (pipe(pfd) == -1)
+			return false;
+		fcntl(pfd[0], F_SETFD, FD_CLOEXEC);
+		fcntl(pfd[1], F_SETFD, FD_CLOEXEC);
+		n->fd = pfd[0];
+		n->child_fd = pfd[1];
+		return true;
+	case NOTIFY_SOCKET:
+		xasprintf(&n->dir, RC_SVCDIR "/notify.%d.%d", getpid(), count++);
+		xasprintf(&n->socket, "%s/socket", n->dir);
+		if (strlen(n->socket) >= sizeof(sun.sun_path)) {
+			errno = ENAMETOOLONG;
+			rc_notify_close(n);
+			return false;
+		}
+		if (mkdir(n->dir, 0700) == -1) {
+			free(n->dir);
+			n->dir = NULL;
+			rc_notify_close(n);
+			return false;
+		}
+		/* Only we remove it, not a child that closes its copy */
+		n->owner = getpid();
+		memset(&sun, 0, sizeof(sun));
+		sun.sun_family = AF_UNIX;
+		strcpy(sun.sun_path, n->socket);
+		if ((n->fd = socket(AF_UNIX, SOCK_DGRAM, 0)) == -1 ||
+		    fcntl(n->fd, F_SETFD, FD_CLOEXEC) == -1 ||
+		    bind(n->fd, (struct sockaddr *)&sun, sizeof(sun)) == -1 ||
+		    (uid != geteuid() &&
+		    (chown(n->socket, uid, (gid_t)-1) == -1 ||
+		    chown(n->dir, uid, (gid_t)-1) == -1)))
+		{
+			rc_notify_close(n);
+			return false;
+		}
+		return true;
+	default:
+		return true;
+	}
+}
+
+/* Called in the daemon just before exec. Any fd but n->target may be
+ * closed afterwards. */
+void
+rc_notify_child(struct notify *n)
+{
+	switch (n->type) {
+	case NOTIFY_FD:
+		/* The read end may sit on the target, so drop it first */
+		if (n->fd != n->target)
+			close(n->fd);
+		if (n->child_fd == n->target)
+			fcntl(n->target, F_SETFD, 0);
+		else {
+			dup2(n->child_fd, n->target);
+			close(n->child_fd);
+		}
+		break;
+	case NOTIFY_SOCKET:
+		close(n->fd);
+		setenv("NOTIFY_SOCKET", n->socket, 1);
+		break;
+	default:
+		break;
+	}
+	n->fd = n->child_fd = -1;
+}
+
+/* Returns true if the message read holds the readiness notification */
+static bool
+notify_ready(struct notify *n, char *buf, ssize_t len)
+{
+	char *p, *line;
+
+	buf[len] = '\0';
+	if (n->type == NOTIFY_FD)
+		return strchr(buf, '\n') != NULL;
+	p = buf;
+	while ((line = strsep(&p, "\n")))
+		if (strcmp(line, "READY=1") == 0)
+			return true;
+	return false;
+}
+
+/*
+ * Waits up to timeout milliseconds for the daemon to be ready.
+ * If pid is not 0 we also give up when that process, which must be our
+ * child, has gone. Nothing else reaps it, so kill would still find it.
+ * Returns 1 when ready, 0 on timeout and -1 if the daemon went away first.
+ */
+int
+rc_notify_wait(struct notify *n, int timeout, pid_t pid)
+{
+	struct pollfd pfd;
+	struct timespec now, end;
+	char buf[BUFSIZ];
+	ssize_t len;
+	int ms, r;
+
+	if (n->type == NOTIFY_NONE)
+		return 1;
+
+	/* Drop our copy of the daemon's end so we see it close */
+	if (n->child_fd != -1) {
+		close(n->child_fd);
+		n->child_fd = -1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	end.tv_sec += timeout / 1000;
+	end.tv_nsec += (timeout % 1000) * 1000000L;
+	if (end.tv_nsec >= 1000000000L) {
+		end.tv_sec++;
+		end.tv_nsec -= 1000000000L;
+	}
+
+	pfd.fd = n->fd;
+	pfd.events = POLLIN;
+	for (;;) {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		ms = (end.tv_sec - now.tv_sec) * 1000 +
+		    (end.tv_nsec - now.tv_nsec) / 1000000L;
+		if (ms <= 0)
+			return 0;
+		if (pid > 0 && ms > NOTIFY_PID_POLL)
+			ms = NOTIFY_PID_POLL;
+		r = poll(&pfd, 1, ms);
+		if (r == -1 && errno != EINTR)
+			return -1;
+		if (r > 0) {
+			len = read(n->fd, buf, sizeof(buf) - 1);
+			if (len == -1 && errno != EINTR && errno != EAGAIN)
+				return -1;
+			/* Every writer has closed the pipe */
+			if (len == 0)
+				return -1;
+			if (len > 0 && notify_ready(n, buf, len))
+				return 1;
+			continue;
+		}
+		if (pid > 0 && waitpid(pid, NULL, WNOHANG) != 0)
+			return -1;
+	}
+}
+
+void
+rc_notify_close(struct notify *n)
+{
+	if (n->fd != -1)
+		close(n->fd);
+	if (n->child_fd != -1)
+		close(n->child_fd);
+	n->fd = n->child_fd = -1;
+	if (n->dir && n->owner == getpid()) {
+		unlink(n->socket);
+		rmdir(n->dir);
+	}
+	free(n->socket);
+	free(n->dir);
+	n->socket = n->dir = NULL;
+}
@@ -0,0 +1,45 @@
+/*
+ * rc-notify.h
+ * Wait for a daemon to say it is ready.
+ */
+
+/*
+ * Copyright (c) 2018 The OpenRC Authors.
+ * See the Authors file at the top-level directory of this distribution and
+ * https://github.com/OpenRC/openrc/blob/master/AUTHORS
+ *
+ * This file is part of OpenRC. It is subject to the license terms in
+ * the LICENSE file found in the top-level directory of this
+ * distribution and at https://github.com/OpenRC/openrc/blob/master/LICENSE
+ * This file may not be copied, modified, propagated, or distributed
+ *    except according to the terms contained in the LICENSE file.
+ */
+
+#ifndef RC_NOTIFY_H
+#define RC_NOTIFY_H
+
+#define RC_NOTIFY_TIMEOUT	60
+
+enum notify_type {
+	NOTIFY_NONE,
+	NOTIFY_FD,
+	NOTIFY_SOCKET,
+};
+
+struct notify {
+	enum notify_type type;
+	int fd;
+	int child_fd;
+	int target;
+	char *socket;
+	char *dir;
+	pid_t owner;
+};
+
+bool rc_notify_parse(struct notify *n, const char *spec);
+bool rc_notify_open(struct notify *n, uid_t uid);
+void rc_notify_child(struct notify *n);
+int rc_notify_wait(struct notify *n, int timeout, pid_t pid);
+void rc_notify_close(struct notify *n);
+
+#endif
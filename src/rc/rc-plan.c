@@ -0,0 +1,238 @@
+/*
+ * rc-plan.c
+ * Cache the service orders we work out when changing runlevels.
+ *
+ * Working out the stop and start order for a runlevel change means
+ * walking the whole dependency tree, yet the same changes happen on
+ * every boot. Each plan is stored with a fingerprint of everything the
+ * order depends on: the deptree itself, the services in the runlevels
+ * involved and the state of every service. If any of those change the
+ * fingerprint no longer matches and the plan is worked out again.
+ *
+ * Plans live in one file in RC_SVCDIR, one per line, so the savecache
+ * service keeps them over a reboot along with the deptree.
+ */
+
+/*
+ * Copyright (c) 2007-2015 The OpenRC Authors.
+ * See the Authors file at the top-level directory of this distribution and
+ * https://github.com/OpenRC/openrc/blob/master/AUTHORS
+ *
+ * This file is part of OpenRC. It is subject to the license terms in
+ * the LICENSE file found in the top-level directory of this
+ * distribution and at https://github.com/OpenRC/openrc/blob/master/LICENSE
+ * This file may not be copied, modified, propagated, or distributed
+ *    except according to the terms contained in the LICENSE file.
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "queue.h"
+#include "rc.h"
+#include "rc-config.h"
+#include "rc-misc.h"
+#include "rc-plan.h"
+
+#define RC_PLANS	RC_SVCDIR "/plans"
+
+struct rc_plan {
+	char *name;
+	char *key;
+	RC_STRINGLIST *list;
+	TAILQ_ENTRY(rc_plan) entries;
+};
+TAILQ_HEAD(rc_plans, rc_plan);
+
+static struct rc_plans plans = TAILQ_HEAD_INITIALIZER(plans);
+static bool plans_loaded;
+static bool plans_dirty;
+
+/* Hash a list of services, which may come from a directory in any order */
+static void
+hash_list(uint64_t *hash, RC_STRINGLIST *list)
+{
+	RC_STRING *s;
+
+	if (list) {
+		rc_stringlist_sort(&list);
+		TAILQ_FOREACH(s, list, entries)
+			hash_string(hash, s->value);
+	}
+	hash_string(hash, NULL);
+	rc_stringlist_free(list);
+}
+
+static void
+hash_file(uint64_t *hash, const char *file)
+{
+	FILE *fp;
+	char buf[BUFSIZ];
+	size_t len;
+
+	if (!(fp = fopen(file, "r")))
+		return;
+	while ((len = fread(buf, 1, sizeof(buf), fp)) > 0)
+		hash_bytes(hash, buf, len);
+	fclose(fp);
+}
+
+static void
+hash_runlevel(uint64_t *hash, const char *level)
+{
+	hash_string(hash, level);
+	if (level) {
+		hash_list(hash, rc_runlevel_stacks(level));
+		hash_list(hash, rc_services_in_runlevel_stacked(level));
+	}
+}
+
+char *
+rc_plan_fingerprint(const char *from, const char *to)
+{
+	static const RC_SERVICE states[] = {
+		RC_SERVICE_STARTED, RC_SERVICE_STARTING, RC_SERVICE_STOPPING,
+		RC_SERVICE_INACTIVE, RC_SERVICE_HOTPLUGGED,
+	};
+	const char *bootlevel = getenv("RC_BOOTLEVEL");
+	uint64_t hash = FNV_OFFSET;
+	char *key;
+	size_t i;
+
+	hash_file(&hash, RC_DEPTREE_CACHE);
+	hash_string(&hash, rc_conf_value("rc_depend_strict"));
+	hash_runlevel(&hash, from);
+	hash_runlevel(&hash, to);
+	hash_runlevel(&hash, RC_LEVEL_SYSINIT);
+	hash_runlevel(&hash, bootlevel);
+	for (i = 0; i < ARRAY_SIZE(states); i++)
+		hash_list(&hash, rc_services_in_state(states[i]));
+
+	xasprintf(&key, "%016llx", (unsigned long long)hash);
+	return key;
+}
+
+static void
+plans_load(void)
+{
+	FILE *fp;
+	char *line = NULL, *p, *token;
+	size_t len = 0;
+	ssize_t l;
+	struct rc_plan *plan;
+
+	plans_loaded = true;
+	if (!(fp = fopen(RC_PLANS, "r")))
+		return;
+	while ((l = getline(&line, &len, fp)) != -1) {
+		if (l > 0 && line[l - 1] == '\n')
+			line[l - 1] = '\0';
+		p = line;
+		plan = xmalloc(sizeof(*plan));
+		plan->name = xstrdup(strsep(&p, " "));
+		plan->key = xstrdup((token = strsep(&p, " ")) ? token : "");
+		plan->list = rc_stringlist_new();
+		while ((token = strsep(&p, " ")))
+			if (*token)
+				rc_stringlist_add(plan->list, token);
+		TAILQ_INSERT_TAIL(&plans, plan, entries);
+	}
+	free(line);
+	fclose(fp);
+}
+
+static struct rc_plan *
+plan_find(const char *name)
+{
+	struct rc_plan *plan;
+
+	if (!plans_loaded)
+		plans_load();
+	TAILQ_FOREACH(plan, &plans, entries)
+		if (strcmp(plan->name, name) == 0)
+			return plan;
+	return NULL;
+}
+
+/* Return a copy of the plan if we have one made with the same key. */
+RC_STRINGLIST *
+rc_plan_get(const char *name, const char *key)
+{
+	struct rc_plan *plan = plan_find(name);
+	RC_STRINGLIST *list;
+	RC_STRING *s;
+
+	if (!plan || strcmp(plan->key, key) != 0)
+		return NULL;
+	list = rc_stringlist_new();
+	TAILQ_FOREACH(s, plan->list, entries)
+		rc_stringlist_add(list, s->value);
+	return list;
+}
+
+void
+rc_plan_set(const char *name, const char *key, RC_STRINGLIST *list)
+{
+	struct rc_plan *plan = plan_find(name);
+	RC_STRING *s;
+
+	if (!plan) {
+		plan = xmalloc(sizeof(*plan));
+		plan->name = xstrdup(name);
+		plan->key = NULL;
+		plan->list = NULL;
+		TAILQ_INSERT_TAIL(&plans, plan, entries);
+	}
+	free(plan->key);
+	rc_stringlist_free(plan->list);
+	plan->key = xstrdup(key);
+	plan->list = rc_stringlist_new();
+	if (list)
+		TAILQ_FOREACH(s, list, entries)
+			rc_stringlist_add(plan->list, s->value);
+	plans_dirty = true;
+}
+
+void
+rc_plan_save(void)
+{
+	FILE *fp;
+	struct rc_plan *plan;
+	RC_STRING *s;
+
+	if (!plans_dirty)
+		return;
+	plans_dirty = false;
+	if (!(fp = fopen(RC_PLANS ".tmp", "w")))
+		return;
+	TAILQ_FOREACH(plan, &plans, entries) {
+		fprintf(fp, "%s %s", plan->name, plan->key);
+		TAILQ_FOREACH(s, plan->list, entries)
+			fprintf(fp, " %s", s->value);
+		fputc('\n', fp);
+	}
+	if (fclose(fp) == 0)
+		rename(RC_PLANS ".tmp", RC_PLANS);
+	else
+		unlink(RC_PLANS ".tmp");
+}
+
+void
+rc_plan_free(void)
+{
+	struct rc_plan *plan;
+
+	while ((plan = TAILQ_FIRST(&plans))) {
+		TAILQ_REMOVE(&plans, plan, entries);
+		free(plan->name);
+		free(plan->key);
+		rc_stringlist_free(plan->list);
+		free(plan);
+	}
+	plans_loaded = false;
+	plans_dirty = false;
+}
@@ -0,0 +1,27 @@
+/*
+ * rc-plan.h
+ * Cache the service orders we work out when changing runlevels.
+ */
+
+/*
+ * Copyright (c) 2007-2015 The OpenRC Authors.
+ * See the Authors file at the top-level directory of this distribution and
+ * https://github.com/OpenRC/openrc/blob/master/AUTHORS
+ *
+ * This file is part of OpenRC. It is subject to the license terms in
+ * the LICENSE file found in the top-level directory of this
+ * distribution and at https://github.com/OpenRC/openrc/blob/master/LICENSE
+ * This file may not be copied, modified, propagated, or distributed
+ *    except according to the terms contained in the LICENSE file.
+ */
+
+#ifndef RC_PLAN_H
+#define RC_PLAN_H
+
+char *rc_plan_fingerprint(const char *from, const char *to);
+RC_STRINGLIST *rc_plan_get(const char *name, const char *key);
+void rc_plan_set(const char *name, const char *key, RC_STRINGLIST *list);
+void rc_plan_save(void);
+void rc_plan_free(void);
+
+#endif
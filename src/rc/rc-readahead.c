@@ -0,0 +1,333 @@
+/*
+ * rc-readahead.c
+ * Record the files opened whilst booting and prefetch them next time.
+ *
+ * With rc_readahead="record" we fork a recorder during sysinit which
+ * uses fanotify to log every regular file opened on the root mounts.
+ * Where fanotify is not available openrc-run appends the scripts and
+ * config files it uses to a trace file instead. The recorder writes the
+ * list once the first runlevel after boot has started and the
+ * savecache service keeps it over a reboot.
+ *
+ * With rc_readahead="replay" we fork a child which sorts the recorded
+ * files by device and inode and asks the kernel to read them in whilst
+ * services are starting.
+ */
+
+/*
+ * Copyright (c) 2007-2015 The OpenRC Authors.
+ * See the Authors file at the top-level directory of this distribution and
+ * https://github.com/OpenRC/openrc/blob/master/AUTHORS
+ *
+ * This file is part of OpenRC. It is subject to the license terms in
+ * the LICENSE file found in the top-level directory of this
+ * distribution and at https://github.com/OpenRC/openrc/blob/master/LICENSE
+ * This file may not be copied, modified, propagated, or distributed
+ *    except according to the terms contained in the LICENSE file.
+ */
+
+#include <sys/types.h>
+#include <sys/select.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#  include <sys/fanotify.h>
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "einfo.h"
+#include "queue.h"
+#include "rc.h"
+#include "rc-misc.h"
+#include "rc-readahead.h"
+
+#define READAHEAD_LIST		RC_SVCDIR "/readahead"
+#define READAHEAD_PIDFILE	RC_SVCDIR "/readahead.pid"
+
+/* Stop recording if we are never told the boot has finished */
+#define READAHEAD_MAX_RECORD	300
+
+struct ra_file {
+	dev_t dev;
+	ino_t ino;
+	char *path;
+};
+
+static volatile sig_atomic_t record_done;
+
+static void
+record_signal(int sig _unused)
+{
+	record_done = 1;
+}
+
+static int
+ra_file_cmp(const void *a, const void *b)
+{
+	const struct ra_file *fa = a, *fb = b;
+
+	if (fa->dev != fb->dev)
+		return fa->dev < fb->dev ? -1 : 1;
+	if (fa->ino != fb->ino)
+		return fa->ino < fb->ino ? -1 : 1;
+	return 0;
+}
+
+static void
+replay(void)
+{
+	FILE *fp;
+	char *line = NULL;
+	size_t len = 0, nfiles = 0, afiles = 0, i;
+	ssize_t l;
+	struct ra_file *files = NULL;
+	struct stat st;
+	int fd;
+
+	if (!(fp = fopen(READAHEAD_LIST, "r")))
+		return;
+	while ((l = getline(&line, &len, fp)) != -1) {
+		if (l > 0 && line[l - 1] == '\n')
+			line[--l] = '\0';
+		if (l == 0 || stat(line, &st) != 0 || !S_ISREG(st.st_mode))
+			continue;
+		if (nfiles == afiles) {
+			afiles = afiles ? afiles * 2 : 256;
+			files = xrealloc(files, sizeof(*files) * afiles);
+		}
+		files[nfiles].dev = st.st_dev;
+		files[nfiles].ino = st.st_ino;
+		files[nfiles].path = xstrdup(line);
+		nfiles++;
+	}
+	free(line);
+	fclose(fp);
+
+	/* Reading in inode order keeps the disk heads moving forwards */
+	qsort(files, nfiles, sizeof(*files), ra_file_cmp);
+	for (i = 0; i < nfiles; i++) {
+		fd = open(files[i].path, O_RDONLY | O_NONBLOCK | O_NOCTTY);
+		if (fd != -1) {
+			posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+			close(fd);
+		}
+		free(files[i].path);
+	}
+	free(files);
+}
+
+#ifdef __linux__
+static int
+record_fanotify_init(void)
+{
+	static const char *const mounts[] = {
+		"/", "/etc", "/bin", "/sbin", "/lib", "/usr", NULL
+	};
+	const char *const *m;
+	int fd;
+
+	fd = fanotify_init(FAN_CLASS_NOTIF | FAN_CLOEXEC,
+	    O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+		return -1;
+	for (m = mounts; *m; m++)
+		if (fanotify_mark(fd, FAN_MARK_ADD | FAN_MARK_MOUNT,
+			FAN_OPEN, AT_FDCWD, *m) == -1 && *m == mounts[0])
+		{
+			close(fd);
+			return -1;
+		}
+	return fd;
+}
+
+/* Our stop signals are blocked except whilst we wait, so one cannot slip
+ * in between looking at record_done and waiting */
+static void
+record_fanotify(int fd, RC_STRINGLIST *files, const sigset_t *waitmask)
+{
+	char buf[4096] __attribute__((aligned(8)));
+	char proc[32], path[PATH_MAX];
+	struct fanotify_event_metadata *ev;
+	struct stat st;
+	ssize_t len, l;
+	pid_t self = getpid();
+	fd_set rfds;
+
+	while (!record_done) {
+		FD_ZERO(&rfds);
+		FD_SET(fd, &rfds);
+		if (pselect(fd + 1, &rfds, NULL, NULL, NULL, waitmask) == -1) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		len = read(fd, buf, sizeof(buf));
+		if (len == -1) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		ev = (struct fanotify_event_metadata *)(void *)buf;
+		for (; FAN_EVENT_OK(ev, len); ev = FAN_EVENT_NEXT(ev, len)) {
+			if (ev->vers != FANOTIFY_METADATA_VERSION)
+				return;
+			if (ev->fd < 0)
+				continue;
+			if (ev->pid != self &&
+			    fstat(ev->fd, &st) == 0 && S_ISREG(st.st_mode))
+			{
+				snprintf(proc, sizeof(proc),
+				    "/proc/self/fd/%d", ev->fd);
+				l = readlink(proc, path, sizeof(path) - 1);
+				if (l > 0) {
+					path[l] = '\0';
+					rc_stringlist_addu(files, path);
+				}
+			}
+			close(ev->fd);
+		}
+	}
+}
+#endif
+
+static void
+record_trace(RC_STRINGLIST *files)
+{
+	FILE *fp;
+	char *line = NULL;
+	size_t len = 0;
+	ssize_t l;
+
+	if (!(fp = fopen(RC_READAHEAD_TRACE, "r")))
+		return;
+	while ((l = getline(&line, &len, fp)) != -1) {
+		if (l > 0 && line[l - 1] == '\n')
+			line[--l] = '\0';
+		if (l > 0)
+			rc_stringlist_addu(files, line);
+	}
+	free(line);
+	fclose(fp);
+}
+
+static void
+record(void)
+{
+	RC_STRINGLIST *files = rc_stringlist_new();
+	RC_STRING *file;
+	FILE *fp;
+	int fd = -1;
+	sigset_t mask, oldmask;
+
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGTERM);
+	sigaddset(&mask, SIGALRM);
+	sigprocmask(SIG_BLOCK, &mask, &oldmask);
+	signal_setup(SIGTERM, record_signal);
+	signal_setup(SIGALRM, record_signal);
+	alarm(READAHEAD_MAX_RECORD);
+
+	if ((fp = fopen(READAHEAD_PIDFILE, "w"))) {
+		fprintf(fp, "%d\n", (int)getpid());
+		fclose(fp);
+	}
+
+#ifdef __linux__
+	fd = record_fanotify_init();
+	if (fd != -1) {
+		record_fanotify(fd, files, &oldmask);
+		close(fd);
+	}
+#endif
+	if (fd == -1) {
+		/* Let openrc-run tell us what it uses */
+		rc_stringlist_add(files, RC_LIBEXECDIR "/sh/openrc-run.sh");
+		rc_stringlist_add(files, RC_LIBEXECDIR "/sh/functions.sh");
+		rc_stringlist_add(files, RC_LIBEXECDIR "/sh/rc-functions.sh");
+		rc_stringlist_add(files, RC_CONF);
+		if ((fp = fopen(RC_READAHEAD_TRACE, "w")))
+			fclose(fp);
+		while (!record_done)
+			sigsuspend(&oldmask);
+		record_trace(files);
+	}
+	sigprocmask(SIG_SETMASK, &oldmask, NULL);
+	unlink(RC_READAHEAD_TRACE);
+
+	if ((fp = fopen(READAHEAD_LIST ".tmp", "w"))) {
+		TAILQ_FOREACH(file, files, entries)
+			fprintf(fp, "%s\n", file->value);
+		if (fclose(fp) == 0)
+			rename(READAHEAD_LIST ".tmp", READAHEAD_LIST);
+		else
+			unlink(READAHEAD_LIST ".tmp");
+	}
+	unlink(READAHEAD_PIDFILE);
+	rc_stringlist_free(files);
+}
+
+static void
+readahead_spawn(void (*func)(void))
+{
+	pid_t pid;
+	int fd;
+
+	if ((pid = fork()) == -1) {
+		eerror("fork: %s", strerror(errno));
+		return;
+	}
+	if (pid != 0)
+		return;
+
+	/* We may outlive the openrc that started us */
+	setsid();
+	signal_setup(SIGINT, SIG_IGN);
+	signal_setup(SIGQUIT, SIG_IGN);
+	signal_setup(SIGHUP, SIG_IGN);
+	signal_setup(SIGTERM, SIG_DFL);
+	if ((fd = open("/dev/null", O_RDWR)) != -1) {
+		dup2(fd, STDIN_FILENO);
+		dup2(fd, STDOUT_FILENO);
+		dup2(fd, STDERR_FILENO);
+		if (fd > STDERR_FILENO)
+			close(fd);
+	}
+	func();
+	_exit(EXIT_SUCCESS);
+}
+
+void
+rc_readahead_start(void)
+{
+	const char *mode = rc_conf_value("rc_readahead");
+
+	if (mode == NULL)
+		return;
+	if (strcmp(mode, "record") == 0)
+		readahead_spawn(record);
+	else if (strcmp(mode, "replay") == 0) {
+		if (exists(READAHEAD_LIST))
+			readahead_spawn(replay);
+	} else {
+		errno = 0;
+		if (rc_yesno(mode) || errno == EINVAL)
+			ewarn("rc_readahead should be record, replay or NO");
+	}
+}
+
+void
+rc_readahead_stop(void)
+{
+	pid_t pid;
+
+	if ((pid = get_pid("readahead", READAHEAD_PIDFILE)) > 0)
+		kill(pid, SIGTERM);
+}
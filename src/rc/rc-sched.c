@@ -0,0 +1,477 @@
+/*
+ * rc-sched.c
+ * Decide which services to start or stop next when running in parallel.
+ *
+ * Each queued service knows which other queued services it has to wait
+ * for. A service becomes ready once all of those have finished.
+ *
+ * When rc_start_history is enabled we record how long each service took
+ * to start and rank ready services by the longest expected chain of work
+ * that is waiting on them, so slow chains are started first.
+ */
+
+/*
+ * Copyright (c) 2007-2015 The OpenRC Authors.
+ * See the Authors file at the top-level directory of this distribution and
+ * https://github.com/OpenRC/openrc/blob/master/AUTHORS
+ *
+ * This file is part of OpenRC. It is subject to the license terms in
+ * the LICENSE file found in the top-level directory of this
+ * distribution and at https://github.com/OpenRC/openrc/blob/master/LICENSE
+ * This file may not be copied, modified, propagated, or distributed
+ *    except according to the terms contained in the LICENSE file.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "einfo.h"
+#include "queue.h"
+#include "rc.h"
+#include "rc-jobs.h"
+#include "rc-misc.h"
+#include "rc-sched.h"
+
+#define RC_HISTORY		RC_HISTORY_DIR "/history"
+
+/* Forget services we have not started for this many days */
+#define RC_HISTORY_EXPIRE	90
+
+/* Assume this much if we have no history at all */
+#define RC_HISTORY_DEFAULT	100
+
+struct rc_history {
+	char *service;
+	unsigned long ms;
+	time_t seen;
+	TAILQ_ENTRY(rc_history) entries;
+};
+TAILQ_HEAD(rc_historylist, rc_history);
+
+static const char *const start_types[] = {
+	"ineed", "iwant", "iuse", "iafter", NULL
+};
+
+static const char *const stop_types[] = {
+	"needsme", "wantsme", "usesme", "ibefore", NULL
+};
+
+/* Samples taken this run, merged into the file when we save */
+static struct rc_historylist samples = TAILQ_HEAD_INITIALIZER(samples);
+
+static struct rc_history *
+history_find(struct rc_historylist *list, const char *service)
+{
+	struct rc_history *h;
+
+	TAILQ_FOREACH(h, list, entries)
+		if (strcmp(h->service, service) == 0)
+			return h;
+	return NULL;
+}
+
+static struct rc_history *
+history_add(struct rc_historylist *list, const char *service,
+    unsigned long ms, time_t seen)
+{
+	struct rc_history *h = xmalloc(sizeof(*h));
+
+	h->service = xstrdup(service);
+	h->ms = ms;
+	h->seen = seen;
+	TAILQ_INSERT_TAIL(list, h, entries);
+	return h;
+}
+
+static void
+history_free(struct rc_historylist *list)
+{
+	struct rc_history *h;
+
+	while ((h = TAILQ_FIRST(list))) {
+		TAILQ_REMOVE(list, h, entries);
+		free(h->service);
+		free(h);
+	}
+}
+
+static void
+history_load(struct rc_historylist *list)
+{
+	FILE *fp;
+	char *line = NULL, *p, *service, *ms, *seen;
+	size_t len = 0;
+
+	if (!(fp = fopen(RC_HISTORY, "r")))
+		return;
+	while (getline(&line, &len, fp) != -1) {
+		p = line;
+		service = strsep(&p, " ");
+		ms = strsep(&p, " ");
+		seen = strsep(&p, "\n");
+		if (!*service || !ms || !seen || history_find(list, service))
+			continue;
+		history_add(list, service, strtoul(ms, NULL, 10),
+		    (time_t)strtoll(seen, NULL, 10));
+	}
+	free(line);
+	fclose(fp);
+}
+
+void
+rc_history_record(const struct rc_job_done *done)
+{
+	struct rc_history *h;
+	unsigned long ms;
+
+	if (!WIFEXITED(done->status) || WEXITSTATUS(done->status) != 0)
+		return;
+	ms = done->elapsed.tv_sec * 1000 + done->elapsed.tv_nsec / 1000000;
+	if ((h = history_find(&samples, done->service)))
+		h->ms = ms;
+	else
+		history_add(&samples, done->service, ms, time(NULL));
+}
+
+/* Fold our samples into the history. Older samples decay away as each
+ * new one only carries a quarter of the weight. The file is read again
+ * here as /var may have been mounted since we started. */
+void
+rc_history_save(void)
+{
+	struct rc_historylist list = TAILQ_HEAD_INITIALIZER(list);
+	struct rc_history *h, *s;
+	time_t now = time(NULL);
+	FILE *fp;
+
+	if (TAILQ_EMPTY(&samples))
+		return;
+	history_load(&list);
+	TAILQ_FOREACH(s, &samples, entries) {
+		if ((h = history_find(&list, s->service))) {
+			h->ms = (h->ms * 3 + s->ms) / 4;
+			h->seen = now;
+		} else
+			history_add(&list, s->service, s->ms, now);
+	}
+	history_free(&samples);
+
+	if (mkdir(RC_HISTORY_DIR, 0755) == -1 && errno != EEXIST)
+		goto out;
+	if (!(fp = fopen(RC_HISTORY ".tmp", "w")))
+		goto out;
+	TAILQ_FOREACH(h, &list, entries)
+		if (now - h->seen < RC_HISTORY_EXPIRE * 24 * 60 * 60)
+			fprintf(fp, "%s %lu %lld\n",
+			    h->service, h->ms, (long long)h->seen);
+	if (fclose(fp) == 0)
+		rename(RC_HISTORY ".tmp", RC_HISTORY);
+	else
+		unlink(RC_HISTORY ".tmp");
+out:
+	history_free(&list);
+}
+
+static void
+add_blockers(const RC_DEPTREE *deptree, RC_STRINGLIST *blockers,
+    RC_STRINGLIST *services, const char *service,
+    const char *const *types, bool providers)
+{
+	const char *const *type;
+	RC_STRINGLIST *deps, *provided;
+	RC_STRING *dep, *p;
+
+	for (type = types; *type; type++) {
+		deps = rc_deptree_depend(deptree, service, *type);
+		TAILQ_FOREACH(dep, deps, entries) {
+			if (rc_stringlist_find(services, dep->value))
+				rc_stringlist_addu(blockers, dep->value);
+			if (!providers)
+				continue;
+			/* We have to wait for whatever provides a virtual
+			 * service we depend on */
+			provided = rc_deptree_depend(deptree, dep->value,
+			    "providedby");
+			TAILQ_FOREACH(p, provided, entries)
+				if (strcmp(p->value, service) != 0 &&
+				    rc_stringlist_find(services, p->value))
+					rc_stringlist_addu(blockers, p->value);
+			rc_stringlist_free(provided);
+		}
+		rc_stringlist_free(deps);
+	}
+}
+
+static struct rc_sched_item *
+new_item(struct rc_sched_queue *queue, const char *service)
+{
+	struct rc_sched_item *item = xmalloc(sizeof(*item));
+
+	memset(item, 0, sizeof(*item));
+	item->service = xstrdup(service);
+	item->blockers = rc_stringlist_new();
+	TAILQ_INSERT_TAIL(queue, item, entries);
+	return item;
+}
+
+static void
+free_item(struct rc_sched_queue *queue, struct rc_sched_item *item)
+{
+	TAILQ_REMOVE(queue, item, entries);
+	rc_stringlist_free(item->blockers);
+	free(item->service);
+	free(item);
+}
+
+/* Services are started once everything they need, want, use or come
+ * after in the queue has started. */
+void
+rc_sched_init_start(struct rc_sched_queue *queue, const RC_DEPTREE *deptree,
+    RC_STRINGLIST *services)
+{
+	struct rc_sched_item *item;
+	RC_STRING *service;
+
+	TAILQ_INIT(queue);
+	TAILQ_FOREACH(service, services, entries) {
+		item = new_item(queue, service->value);
+		add_blockers(deptree, item->blockers, services,
+		    service->value, start_types, true);
+	}
+}
+
+/* Services are stopped once everything in the queue which needs, wants
+ * or uses them, or was started after them, has stopped. That includes
+ * anything depending on a virtual service they provide. */
+void
+rc_sched_init_stop(struct rc_sched_queue *queue, const RC_DEPTREE *deptree,
+    RC_STRINGLIST *services)
+{
+	struct rc_sched_item *item;
+	RC_STRINGLIST *provided;
+	RC_STRING *service, *p;
+
+	TAILQ_INIT(queue);
+	TAILQ_FOREACH(service, services, entries) {
+		item = new_item(queue, service->value);
+		add_blockers(deptree, item->blockers, services,
+		    service->value, stop_types, false);
+		provided = rc_deptree_depend(deptree, service->value,
+		    "iprovide");
+		TAILQ_FOREACH(p, provided, entries)
+			add_blockers(deptree, item->blockers, services,
+			    p->value, stop_types, false);
+		rc_stringlist_free(provided);
+	}
+}
+
+void
+rc_sched_free(struct rc_sched_queue *queue)
+{
+	struct rc_sched_item *item;
+
+	while ((item = TAILQ_FIRST(queue)))
+		free_item(queue, item);
+}
+
+static unsigned long
+rank_item(struct rc_sched_queue *queue, struct rc_sched_item *item)
+{
+	struct rc_sched_item *other;
+	unsigned long best = 0, r;
+
+	if (item->ranked)
+		return item->rank;
+	/* Mark us first so a dependency loop cannot recurse forever */
+	item->ranked = true;
+	item->rank = item->weight;
+	TAILQ_FOREACH(other, queue, entries) {
+		if (!rc_stringlist_find(other->blockers, item->service))
+			continue;
+		r = rank_item(queue, other);
+		if (r > best)
+			best = r;
+	}
+	item->rank = item->weight + best;
+	return item->rank;
+}
+
+/* Weigh each service by how long it took to start before. Services we
+ * know nothing about are assumed to take the average time. */
+void
+rc_sched_rank(struct rc_sched_queue *queue)
+{
+	struct rc_historylist list = TAILQ_HEAD_INITIALIZER(list);
+	struct rc_history *h;
+	struct rc_sched_item *item;
+	unsigned long total = 0, known = 0, def = RC_HISTORY_DEFAULT;
+
+	history_load(&list);
+	TAILQ_FOREACH(h, &list, entries) {
+		total += h->ms;
+		known++;
+	}
+	if (known)
+		def = total / known;
+
+	TAILQ_FOREACH(item, queue, entries) {
+		h = history_find(&list, item->service);
+		item->weight = h ? h->ms : def;
+		item->ranked = false;
+	}
+	TAILQ_FOREACH(item, queue, entries)
+		rank_item(queue, item);
+	history_free(&list);
+}
+
+static bool
+blocked(struct rc_sched_queue *queue, struct rc_sched_item *item)
+{
+	struct rc_sched_item *other;
+
+	TAILQ_FOREACH(other, queue, entries)
+		if (other != item &&
+		    rc_stringlist_find(item->blockers, other->service))
+			return true;
+	return false;
+}
+
+/* Return the next service which is ready to go, either the first in
+ * the queue or the one with the highest rank. */
+static struct rc_sched_item *
+next_item(struct rc_sched_queue *queue, bool by_rank)
+{
+	struct rc_sched_item *item, *best = NULL;
+
+	TAILQ_FOREACH(item, queue, entries) {
+		if (item->running || blocked(queue, item))
+			continue;
+		if (!by_rank)
+			return item;
+		if (!best || item->rank > best->rank)
+			best = item;
+	}
+	return best;
+}
+
+/* Nothing is ready and nothing is running, so we have a dependency loop.
+ * Let the first service in the queue go anyway so we can carry on. */
+static void
+break_loop(struct rc_sched_queue *queue)
+{
+	struct rc_sched_item *item = TAILQ_FIRST(queue);
+
+	rc_stringlist_free(item->blockers);
+	item->blockers = rc_stringlist_new();
+}
+
+/* How many services to run at once, 0 meaning no limit */
+int
+rc_sched_max(bool parallel)
+{
+	const char *value;
+	int max;
+
+	if (!parallel)
+		return 1;
+	value = rc_conf_value("rc_parallel_max");
+	if (value == NULL)
+		return 0;
+	max = atoi(value);
+	return max > 0 ? max : 0;
+}
+
+void
+rc_sched_run(struct rc_sched_queue *queue, int max, bool by_rank,
+    rc_sched_launch launch, void *arg, bool record)
+{
+	struct rc_sched_item *item, *np;
+	struct rc_job_done done;
+	int running = 0;
+	bool launched;
+	pid_t pid;
+
+	while (!TAILQ_EMPTY(queue)) {
+		launched = false;
+		while ((max <= 0 || running < max) &&
+		    (item = next_item(queue, by_rank)))
+		{
+			launched = true;
+			pid = launch(item->service, arg);
+			if (pid > 0) {
+				rc_jobs_add(pid, item->service);
+				item->pid = pid;
+				item->running = true;
+				running++;
+			} else
+				free_item(queue, item);
+		}
+
+		if (running == 0) {
+			if (!launched && !TAILQ_EMPTY(queue))
+				break_loop(queue);
+			continue;
+		}
+
+		if (!rc_jobs_wait(&done, -1)) {
+			/* Nothing left to wait for */
+			TAILQ_FOREACH_SAFE(item, queue, entries, np)
+				if (item->running)
+					free_item(queue, item);
+			running = 0;
+			continue;
+		}
+		if (record)
+			rc_history_record(&done);
+		TAILQ_FOREACH(item, queue, entries)
+			if (item->running && item->pid == done.pid) {
+				free_item(queue, item);
+				running--;
+				break;
+			}
+		free(done.service);
+	}
+}
+
+/* Work out how long the queue would take to run given the weights from
+ * rc_sched_rank. The queue is emptied. */
+unsigned long
+rc_sched_simulate(struct rc_sched_queue *queue, int max, bool by_rank)
+{
+	struct rc_sched_item *item, *first;
+	unsigned long now = 0;
+	int running = 0;
+
+	while (!TAILQ_EMPTY(queue)) {
+		while ((max <= 0 || running < max) &&
+		    (item = next_item(queue, by_rank)))
+		{
+			item->running = true;
+			item->finish = now + item->weight;
+			running++;
+		}
+
+		if (running == 0) {
+			break_loop(queue);
+			continue;
+		}
+
+		first = NULL;
+		TAILQ_FOREACH(item, queue, entries)
+			if (item->running &&
+			    (!first || item->finish < first->finish))
+				first = item;
+		now = first->finish;
+		free_item(queue, first);
+		running--;
+	}
+	return now;
+}
@@ -0,0 +1,52 @@
+/*
+ * rc-sched.h
+ * Decide which services to start or stop next when running in parallel.
+ */
+
+/*
+ * Copyright (c) 2007-2015 The OpenRC Authors.
+ * See the Authors file at the top-level directory of this distribution and
+ * https://github.com/OpenRC/openrc/blob/master/AUTHORS
+ *
+ * This file is part of OpenRC. It is subject to the license terms in
+ * the LICENSE file found in the top-level directory of this
+ * distribution and at https://github.com/OpenRC/openrc/blob/master/LICENSE
+ * This file may not be copied, modified, propagated, or distributed
+ *    except according to the terms contained in the LICENSE file.
+ */
+
+#ifndef RC_SCHED_H
+#define RC_SCHED_H
+
+/* A queued service and the queued services it has to wait for. */
+struct rc_sched_item {
+	char *service;
+	RC_STRINGLIST *blockers;
+	pid_t pid;
+	bool running;
+	unsigned long weight;	/* expected run time in ms */
+	unsigned long rank;	/* weight plus the longest chain after us */
+	bool ranked;
+	unsigned long finish;	/* only used when simulating */
+	TAILQ_ENTRY(rc_sched_item) entries;
+};
+TAILQ_HEAD(rc_sched_queue, rc_sched_item);
+
+typedef pid_t (*rc_sched_launch)(const char *service, void *arg);
+
+void rc_sched_init_start(struct rc_sched_queue *, const RC_DEPTREE *,
+    RC_STRINGLIST *);
+void rc_sched_init_stop(struct rc_sched_queue *, const RC_DEPTREE *,
+    RC_STRINGLIST *);
+void rc_sched_free(struct rc_sched_queue *);
+void rc_sched_rank(struct rc_sched_queue *);
+int rc_sched_max(bool parallel);
+void rc_sched_run(struct rc_sched_queue *, int max, bool by_rank,
+    rc_sched_launch launch, void *arg, bool record);
+unsigned long rc_sched_simulate(struct rc_sched_queue *, int max,
+    bool by_rank);
+
+void rc_history_record(const struct rc_job_done *);
+void rc_history_save(void);
+
+#endif
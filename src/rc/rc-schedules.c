@@ -16,13 +16,18 @@
  */
 
 /* nano seconds */
-#define POLL_INTERVAL   20000000
-#define WAIT_PIDFILE   500000000
 #define ONE_SECOND    1000000000
 #define ONE_MS           1000000
 
+/* milli seconds, how often we look for processes we cannot wait on.
+ * We start often so quick exits are seen quickly, then back off. */
+#define POLL_MIN                 1
+#define POLL_MAX               250
+
 #include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
 #include <signal.h>
 #include <stddef.h>
 #include <stdio.h>
@@ -30,10 +35,14 @@
 #include <string.h>
 #include <time.h>
 #include <unistd.h>
+#include <sys/file.h>
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#ifdef __linux__
+#  include <sys/syscall.h>
+#endif
 
 #include "einfo.h"
 #include "queue.h"
@@ -56,6 +65,27 @@ typedef struct scheduleitem {
 
 static TAILQ_HEAD(, scheduleitem) schedule;
 
+#if defined(SYS_pidfd_open) && defined(SYS_pidfd_send_signal)
+#  define HAVE_PIDFD
+#endif
+
+/* A process we are stopping, held by a pidfd so a reused pid can never
+ * get our signals and we can poll for it to exit */
+struct stop_target {
+	pid_t pid;
+	int fd;
+	bool gone;
+	LIST_ENTRY(stop_target) entries;
+};
+LIST_HEAD(stop_targets, stop_target);
+
+/* How long the processes took to go after each signal we sent */
+struct stop_steps {
+	char *text;
+	int sig;
+	struct timespec sent;
+};
+
 void free_schedulelist(void)
 {
 	SCHEDULEITEM *s1 = TAILQ_FIRST(&schedule);
@@ -69,56 +99,66 @@ void free_schedulelist(void)
 	TAILQ_INIT(&schedule);
 }
 
-int parse_signal(const char *applet, const char *sig)
+typedef struct signalpair
 {
-	typedef struct signalpair
-	{
-		const char *name;
-		int signal;
-	} SIGNALPAIR;
+	const char *name;
+	int signal;
+} SIGNALPAIR;
 
 #define signalpair_item(name) { #name, SIG##name },
 
-	static const SIGNALPAIR signallist[] = {
-		signalpair_item(HUP)
-		signalpair_item(INT)
-		signalpair_item(QUIT)
-		signalpair_item(ILL)
-		signalpair_item(TRAP)
-		signalpair_item(ABRT)
-		signalpair_item(BUS)
-		signalpair_item(FPE)
-		signalpair_item(KILL)
-		signalpair_item(USR1)
-		signalpair_item(SEGV)
-		signalpair_item(USR2)
-		signalpair_item(PIPE)
-		signalpair_item(ALRM)
-		signalpair_item(TERM)
-		signalpair_item(CHLD)
-		signalpair_item(CONT)
-		signalpair_item(STOP)
-		signalpair_item(TSTP)
-		signalpair_item(TTIN)
-		signalpair_item(TTOU)
-		signalpair_item(URG)
-		signalpair_item(XCPU)
-		signalpair_item(XFSZ)
-		signalpair_item(VTALRM)
-		signalpair_item(PROF)
+static const SIGNALPAIR signallist[] = {
+	signalpair_item(HUP)
+	signalpair_item(INT)
+	signalpair_item(QUIT)
+	signalpair_item(ILL)
+	signalpair_item(TRAP)
+	signalpair_item(ABRT)
+	signalpair_item(BUS)
+	signalpair_item(FPE)
+	signalpair_item(KILL)
+	signalpair_item(USR1)
+	signalpair_item(SEGV)
+	signalpair_item(USR2)
+	signalpair_item(PIPE)
+	signalpair_item(ALRM)
+	signalpair_item(TERM)
+	signalpair_item(CHLD)
+	signalpair_item(CONT)
+	signalpair_item(STOP)
+	signalpair_item(TSTP)
+	signalpair_item(TTIN)
+	signalpair_item(TTOU)
+	signalpair_item(URG)
+	signalpair_item(XCPU)
+	signalpair_item(XFSZ)
+	signalpair_item(VTALRM)
+	signalpair_item(PROF)
 #ifdef SIGWINCH
-		signalpair_item(WINCH)
+	signalpair_item(WINCH)
 #endif
 #ifdef SIGIO
-		signalpair_item(IO)
+	signalpair_item(IO)
 #endif
 #ifdef SIGPWR
-		signalpair_item(PWR)
+	signalpair_item(PWR)
 #endif
-		signalpair_item(SYS)
-		{ "NULL",	0 },
-	};
+	signalpair_item(SYS)
+	{ "NULL",	0 },
+};
 
+static const char *signal_name(int sig)
+{
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(signallist); ++i)
+		if (signallist[i].signal == sig)
+			return signallist[i].name;
+	return NULL;
+}
+
+int parse_signal(const char *applet, const char *sig)
+{
 	unsigned int i = 0;
 	const char *s;
 
@@ -293,24 +333,271 @@ int do_stop(const char *applet, const char *exec, const char *const *argv,
 	return nkilled;
 }
 
-int run_stop_schedule(const char *applet,
+/* As do_stop, but for every process in a cgroup2 group */
+static int do_stop_cgroup(const char *applet, const char *cgroup, int sig,
+    bool test, bool quiet)
+{
+	int n;
+
+	if (test || sig == 0) {
+		n = rc_cgroup_kill(cgroup, 0);
+		if (test && n > 0)
+			einfo("Would send signal %d to %d process(es) in %s",
+			    sig, n, cgroup);
+		return n > 0 ? n : 0;
+	}
+
+	if (!quiet)
+		ebeginv("Sending signal %d to %s", sig, cgroup);
+	errno = 0;
+	n = rc_cgroup_kill(cgroup, sig);
+	if (n == -1 && errno == ENOENT)
+		n = 0;
+	if (!quiet)
+		eendv(n == -1 ? 1 : 0,
+		    "%s: failed to send signal %d to %s: %s",
+		    applet, sig, cgroup, strerror(errno));
+	return n;
+}
+
+#ifdef HAVE_PIDFD
+static struct stop_target *find_target(struct stop_targets *targets,
+    pid_t pid)
+{
+	struct stop_target *t;
+
+	LIST_FOREACH(t, targets, entries)
+		if (t->pid == pid && !t->gone)
+			return t;
+	return NULL;
+}
+
+/* As do_stop, but match the processes against /proc only here, once
+ * for each signal, and keep a pidfd for each one we find.
+ * Returns -2 if we cannot use pidfds. */
+static int do_stop_pidfd(const char *applet, const char *exec,
+    const char *const *argv, pid_t pid, uid_t uid, int sig, bool quiet,
+    struct stop_targets *targets)
+{
+	RC_PIDLIST *pids;
+	RC_PID *pi;
+	RC_PID *np;
+	struct stop_target *t;
+	bool killed;
+	int fd, nkilled = 0;
+
+	if (pid > 0)
+		pids = rc_find_pids(NULL, NULL, 0, pid);
+	else
+		pids = rc_find_pids(exec, argv, uid, 0);
+
+	if (pids) {
+		LIST_FOREACH_SAFE(pi, pids, entries, np) {
+			if (nkilled != -2 && !find_target(targets, pi->pid)) {
+				fd = syscall(SYS_pidfd_open, pi->pid, 0);
+				if (fd != -1) {
+					t = xmalloc(sizeof(*t));
+					t->pid = pi->pid;
+					t->fd = fd;
+					t->gone = false;
+					LIST_INSERT_HEAD(targets, t, entries);
+				} else if (errno != ESRCH)
+					nkilled = -2;
+			}
+			free(pi);
+		}
+		free(pids);
+	}
+	if (nkilled == -2)
+		return -2;
+
+	LIST_FOREACH(t, targets, entries) {
+		if (t->gone)
+			continue;
+		if (!quiet)
+			ebeginv("Sending signal %d to PID %d", sig, t->pid);
+		errno = 0;
+		killed = (syscall(SYS_pidfd_send_signal, t->fd, sig,
+			NULL, 0) == 0 || errno == ESRCH);
+		if (!quiet)
+			eendv(killed ? 0 : 1,
+			    "%s: failed to send signal %d to PID %d: %s",
+			    applet, sig, t->pid, strerror(errno));
+		if (errno == ESRCH)
+			t->gone = true;
+		if (!killed)
+			nkilled = -1;
+		else if (nkilled != -1)
+			nkilled++;
+	}
+	return nkilled;
+}
+
+/* Wait up to timeout ms for our targets to exit, which makes their
+ * pidfds readable. Returns how many are still running. */
+static int wait_pidfd(struct stop_targets *targets, int timeout)
+{
+	struct stop_target *t;
+	struct pollfd *pfds;
+	struct timespec now, end;
+	int i, n, ms, nrunning;
+	bool done = false;
+
+	n = 0;
+	LIST_FOREACH(t, targets, entries)
+		n++;
+	pfds = xmalloc(sizeof(*pfds) * (n ? n : 1));
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	end.tv_sec += timeout / 1000;
+	end.tv_nsec += (timeout % 1000) * ONE_MS;
+	if (end.tv_nsec >= ONE_SECOND) {
+		end.tv_sec++;
+		end.tv_nsec -= ONE_SECOND;
+	}
+
+	for (;;) {
+		nrunning = 0;
+		LIST_FOREACH(t, targets, entries)
+			if (!t->gone) {
+				pfds[nrunning].fd = t->fd;
+				pfds[nrunning].events = POLLIN;
+				pfds[nrunning].revents = 0;
+				nrunning++;
+			}
+		if (nrunning == 0 || done)
+			break;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		ms = (end.tv_sec - now.tv_sec) * 1000 +
+		    (end.tv_nsec - now.tv_nsec) / ONE_MS;
+		/* Out of time, but still look once more */
+		if (ms <= 0) {
+			ms = 0;
+			done = true;
+		}
+		if (poll(pfds, nrunning, ms) == -1 && errno != EINTR)
+			break;
+		for (i = 0; i < nrunning; i++) {
+			if (!pfds[i].revents)
+				continue;
+			LIST_FOREACH(t, targets, entries)
+				if (t->fd == pfds[i].fd)
+					t->gone = true;
+		}
+	}
+	free(pfds);
+	return nrunning;
+}
+#endif
+
+static long elapsed_ms(const struct timespec *since)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - since->tv_sec) * 1000 +
+	    (now.tv_nsec - since->tv_nsec) / ONE_MS;
+}
+
+/* Note how the last signal went, with > if they were still running */
+static void step_done(struct stop_steps *steps, bool exited)
+{
+	const char *name;
+	char num[12], *old = steps->text;
+	long ms;
+
+	if (steps->sig == -1)
+		return;
+	ms = elapsed_ms(&steps->sent);
+	if (!(name = signal_name(steps->sig))) {
+		snprintf(num, sizeof(num), "%d", steps->sig);
+		name = num;
+	}
+	if (exited)
+		einfov("Stopped %ld ms after SIG%s", ms, name);
+	xasprintf(&steps->text, "%s%s%s:%s%ld", old ? old : "",
+	    old ? " " : "", name, exited ? "" : ">", ms);
+	free(old);
+	steps->sig = -1;
+}
+
+static void step_sent(struct stop_steps *steps, int sig)
+{
+	step_done(steps, false);
+	steps->sig = sig;
+	clock_gettime(CLOCK_MONOTONIC, &steps->sent);
+}
+
+/* With rc_start_history we keep the steps of the last stop of each
+ * service, one line each, so retry schedules can be tuned from them */
+static void save_steps(const char *svcname, const char *steps)
+{
+	FILE *fp, *tmp;
+	char *line = NULL, *tmpfile;
+	size_t len = 0, n = strlen(svcname);
+	int dirfd;
+
+	if (mkdir(RC_HISTORY_DIR, 0755) == -1 && errno != EEXIST)
+		return;
+	if ((dirfd = open(RC_HISTORY_DIR, O_RDONLY | O_CLOEXEC)) == -1)
+		return;
+	/* Services stop in parallel, so one of us rewrites it at a time */
+	flock(dirfd, LOCK_EX);
+	xasprintf(&tmpfile, "%s.%d", RC_STOP_HISTORY, getpid());
+	if ((tmp = fopen(tmpfile, "w"))) {
+		if ((fp = fopen(RC_STOP_HISTORY, "r"))) {
+			while (getline(&line, &len, fp) != -1)
+				if (strncmp(line, svcname, n) != 0 ||
+				    line[n] != ' ')
+					fputs(line, tmp);
+			fclose(fp);
+		}
+		fprintf(tmp, "%s %s\n", svcname, steps);
+		if (fclose(tmp) == 0)
+			rename(tmpfile, RC_STOP_HISTORY);
+		else
+			unlink(tmpfile);
+	}
+	free(line);
+	free(tmpfile);
+	close(dirfd);
+}
+
+static void free_targets(struct stop_targets *targets)
+{
+	struct stop_target *t;
+
+	while ((t = LIST_FIRST(targets))) {
+		LIST_REMOVE(t, entries);
+		close(t->fd);
+		free(t);
+	}
+}
+
+static int stop_schedule(const char *applet,
 		const char *exec, const char *const *argv,
-		pid_t pid, uid_t uid,
-    bool test, bool progress, bool quiet)
+		pid_t pid, uid_t uid, const char *cgroup,
+    bool test, bool progress, bool quiet, struct stop_targets *targets,
+    struct stop_steps *steps)
 {
 	SCHEDULEITEM *item = TAILQ_FIRST(&schedule);
 	int nkilled = 0;
 	int tkilled = 0;
 	int nrunning = 0;
-	long nloops, nsecs;
-	struct timespec ts;
+	long nsecs, ms, delay;
+	struct timespec ts, start;
 	const char *const *p;
 	bool progressed = false;
+#ifdef HAVE_PIDFD
+	bool pidfds = !test && !cgroup;
+#endif
 
-	if (!(pid > 0 || exec || uid || (argv && *argv)))
+	if (!(pid > 0 || exec || uid || cgroup || (argv && *argv)))
 		return 0;
 
-	if (exec)
+	if (cgroup)
+		einfov("Will stop processes in %s", cgroup);
+	else if (exec)
 		einfov("Will stop %s", exec);
 	if (pid > 0)
 		einfov("Will stop PID %d", pid);
@@ -336,8 +623,19 @@ int run_stop_schedule(const char *applet,
 
 		case SC_SIGNAL:
 			nrunning = 0;
-			nkilled = do_stop(applet, exec, argv, pid, uid, item->value, test,
-					quiet);
+			nkilled = -2;
+#ifdef HAVE_PIDFD
+			if (pidfds &&
+			    (nkilled = do_stop_pidfd(applet, exec, argv, pid,
+				uid, item->value, quiet, targets)) == -2)
+				pidfds = false;
+#endif
+			if (cgroup)
+				nkilled = do_stop_cgroup(applet, cgroup,
+				    item->value, test, quiet);
+			else if (nkilled == -2)
+				nkilled = do_stop(applet, exec, argv, pid, uid,
+				    item->value, test, quiet);
 			if (nkilled == 0) {
 				if (tkilled == 0) {
 					if (progressed)
@@ -350,6 +648,8 @@ int run_stop_schedule(const char *applet,
 				return 0;
 
 			tkilled += nkilled;
+			if (!test)
+				step_sent(steps, item->value);
 			break;
 		case SC_TIMEOUT:
 			if (item->value < 1) {
@@ -357,39 +657,86 @@ int run_stop_schedule(const char *applet,
 				break;
 			}
 
-			ts.tv_sec = 0;
-			ts.tv_nsec = POLL_INTERVAL;
-
-			for (nsecs = 0; nsecs < item->value; nsecs++) {
-				for (nloops = 0;
-				     nloops < ONE_SECOND / POLL_INTERVAL;
-				     nloops++)
-				{
-					if ((nrunning = do_stop(applet, exec, argv,
-						    pid, uid, 0, test, quiet)) == 0)
+			/* The kernel tells us when the group empties */
+			if (cgroup && !test) {
+				for (nsecs = 0; nsecs < item->value; nsecs++) {
+					if (rc_cgroup_wait(cgroup, 1000)) {
+						step_done(steps, true);
 						return 0;
+					}
+					if (progress) {
+						printf(".");
+						fflush(stdout);
+						progressed = true;
+					}
+				}
+				nrunning = do_stop_cgroup(applet, cgroup, 0,
+				    test, quiet);
+				break;
+			}
 
-
-					if (nanosleep(&ts, NULL) == -1) {
-						if (progressed) {
-							printf("\n");
-							progressed = false;
-						}
-						if (errno == EINTR)
-							eerror("%s: caught an"
-							    " interrupt", applet);
-						else {
-							eerror("%s: nanosleep: %s",
-							    applet, strerror(errno));
-							return 0;
-						}
+#ifdef HAVE_PIDFD
+			/* Or when our pidfds say the processes have exited */
+			if (pidfds && LIST_FIRST(targets)) {
+				for (nsecs = 0; nsecs < item->value; nsecs++) {
+					if (wait_pidfd(targets, 1000) == 0) {
+						step_done(steps, true);
+						return 0;
+					}
+					if (progress) {
+						printf(".");
+						fflush(stdout);
+						progressed = true;
 					}
 				}
-				if (progress) {
+				nrunning = wait_pidfd(targets, 0);
+				break;
+			}
+#endif
+
+			/* Otherwise nothing tells us, so we look */
+			clock_gettime(CLOCK_MONOTONIC, &start);
+			delay = POLL_MIN;
+			nsecs = 0;
+			for (;;) {
+				/* Our own child would linger as a zombie */
+				if (pid > 0 && !test)
+					waitpid(pid, NULL, WNOHANG);
+				if ((nrunning = do_stop(applet, exec, argv,
+					    pid, uid, 0, test, quiet)) == 0)
+				{
+					step_done(steps, true);
+					return 0;
+				}
+
+				ms = elapsed_ms(&start);
+				for (; progress && nsecs < ms / 1000; nsecs++) {
 					printf(".");
 					fflush(stdout);
 					progressed = true;
 				}
+				if (ms >= item->value * 1000L)
+					break;
+
+				if (delay > item->value * 1000L - ms)
+					delay = item->value * 1000L - ms;
+				ts.tv_sec = delay / 1000;
+				ts.tv_nsec = (delay % 1000) * ONE_MS;
+				if (nanosleep(&ts, NULL) == -1) {
+					if (progressed) {
+						printf("\n");
+						progressed = false;
+					}
+					if (errno == EINTR)
+						eerror("%s: caught an"
+						    " interrupt", applet);
+					else {
+						eerror("%s: nanosleep: %s",
+						    applet, strerror(errno));
+						return 0;
+					}
+				}
+				delay = delay * 2 > POLL_MAX ? POLL_MAX : delay * 2;
 			}
 			break;
 		default:
@@ -406,6 +753,7 @@ int run_stop_schedule(const char *applet,
 			item = TAILQ_NEXT(item, entries);
 	}
 
+	step_done(steps, false);
 	if (test || (tkilled > 0 && nrunning == 0))
 		return nkilled;
 
@@ -420,3 +768,22 @@ int run_stop_schedule(const char *applet,
 
 	return -nrunning;
 }
+
+int run_stop_schedule(const char *applet,
+		const char *exec, const char *const *argv,
+		pid_t pid, uid_t uid, const char *cgroup,
+    bool test, bool progress, bool quiet)
+{
+	struct stop_targets targets = LIST_HEAD_INITIALIZER(targets);
+	struct stop_steps steps = { NULL, -1, { 0, 0 } };
+	const char *svcname = getenv("RC_SVCNAME");
+	int nkilled;
+
+	nkilled = stop_schedule(applet, exec, argv, pid, uid, cgroup,
+	    test, progress, quiet, &targets, &steps);
+	free_targets(&targets);
+	if (steps.text && svcname && rc_conf_yesno("rc_start_history"))
+		save_steps(svcname, steps.text);
+	free(steps.text);
+	return nkilled;
+}
@@ -20,7 +20,7 @@ int do_stop(const char *applet, const char *exec, const char *const *argv,
 		pid_t pid, uid_t uid,int sig, bool test, bool quiet);
 int run_stop_schedule(const char *applet,
 		const char *exec, const char *const *argv,
-		pid_t pid, uid_t uid,
+		pid_t pid, uid_t uid, const char *cgroup,
 		bool test, bool progress, bool quiet);
 
 #endif
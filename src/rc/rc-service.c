@@ -15,7 +15,10 @@
  *    except according to the terms contained in the LICENSE file.
  */
 
+#include <errno.h>
 #include <getopt.h>
+#include <signal.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -24,13 +27,16 @@
 #include "einfo.h"
 #include "queue.h"
 #include "rc.h"
+#include "rc-jobs.h"
 #include "rc-misc.h"
+#include "rc-sched.h"
 #include "_usage.h"
 
 const char *applet = NULL;
 const char *extraopts = NULL;
-const char *getoptstring = "cdDe:ilr:INsSZ" getoptstring_COMMON;
+const char *getoptstring = "bcdDe:ilr:INsSZ" getoptstring_COMMON;
 const struct option longopts[] = {
+	{ "batch",     0, NULL, 'b' },
 	{ "debug",     0, NULL, 'd' },
 	{ "nodeps",     0, NULL, 'D' },
 	{ "exists",   1, NULL, 'e' },
@@ -46,6 +52,7 @@ const struct option longopts[] = {
 	longopts_COMMON
 };
 const char * const longopts_help[] = {
+	"run start, stop or restart on several services at once",
 	"set xtrace when running the command",
 	"ignore dependencies",
 	"tests if the service exists or not",
@@ -60,23 +67,203 @@ const char * const longopts_help[] = {
 };
 const char *usagestring = ""							\
 	"Usage: rc-service [options] [-i] <service> <cmd>...\n"		\
+	"   or: rc-service [options] -b <cmd> <service>...\n"		\
 	"   or: rc-service [options] -e <service>\n"			\
 	"   or: rc-service [options] -l\n"				\
 	"   or: rc-service [options] -r <service>";
 
+static bool if_crashed = false;
+static bool if_exists = false;
+static bool if_inactive = false;
+static bool if_notstarted = false;
+static bool if_started = false;
+static bool if_stopped = false;
+
+/* Should we run the command on a service in this state? */
+static bool
+wanted(const char *service)
+{
+	RC_SERVICE state = rc_service_state(service);
+
+	if (if_crashed &&  ! (rc_service_daemons_crashed(service) && errno != EACCES))
+		return false;
+	if (if_inactive && ! (state & RC_SERVICE_INACTIVE))
+		return false;
+	if (if_notstarted && (state & RC_SERVICE_STARTED))
+		return false;
+	if (if_started && ! (state & RC_SERVICE_STARTED))
+		return false;
+	if (if_stopped && ! (state & RC_SERVICE_STOPPED))
+		return false;
+	return true;
+}
+
+static void
+handle_signal(int sig)
+{
+	if (sig == SIGCHLD)
+		rc_jobs_sigchld();
+}
+
+static pid_t
+batch_stop(const char *service, void *arg _unused)
+{
+	if (rc_service_state(service) & RC_SERVICE_STOPPED)
+		return 0;
+	return service_stop(service);
+}
+
+static pid_t
+batch_start(const char *service, void *arg _unused)
+{
+	if (!(rc_service_state(service) & RC_SERVICE_STOPPED))
+		return 0;
+	return service_start(service);
+}
+
+/* Add the services in list which are not stopped, or which are,
+ * to services. */
+static void
+add_state(RC_STRINGLIST *services, RC_STRINGLIST *list, bool stopped)
+{
+	RC_STRING *s;
+
+	TAILQ_FOREACH(s, list, entries)
+		if (!(rc_service_state(s->value) & RC_SERVICE_STOPPED) !=
+		    stopped)
+			rc_stringlist_addu(services, s->value);
+}
+
+/* Work out every service the command touches from one load of the
+ * deptree, then stop and start them in dependency order, as many at
+ * once as rc_parallel_max allows, the same as a runlevel change. */
+static int
+batch(const char *cmd, char **argv)
+{
+	RC_DEPTREE *deptree;
+	RC_STRINGLIST *services, *types, *list;
+	RC_STRINGLIST *stop, *start, *all;
+	RC_STRING *s;
+	RC_SERVICE state;
+	struct rc_sched_queue queue;
+	char *service;
+	bool do_stop, do_start, nodeps, ok;
+	int max, retval = EXIT_SUCCESS;
+
+	do_stop = strcmp(cmd, "stop") == 0 || strcmp(cmd, "restart") == 0;
+	do_start = strcmp(cmd, "start") == 0 || strcmp(cmd, "restart") == 0;
+	if (!do_stop && !do_start)
+		eerrorx("%s: --batch only runs start, stop or restart", applet);
+	if (*argv == NULL)
+		eerrorx("%s: you need to specify a service", applet);
+
+	services = rc_stringlist_new();
+	for (; *argv; argv++) {
+		if ((service = rc_service_resolve(*argv)) == NULL) {
+			if (if_exists)
+				continue;
+			eerrorx("%s: service `%s' does not exist",
+			    applet, *argv);
+		}
+		free(service);
+		if (wanted(*argv))
+			rc_stringlist_addu(services, *argv);
+	}
+	if (TAILQ_FIRST(services) == NULL) {
+		rc_stringlist_free(services);
+		return EXIT_SUCCESS;
+	}
+
+	if ((deptree = _rc_deptree_load(0, NULL)) == NULL)
+		eerrorx("%s: failed to load deptree", applet);
+	nodeps = rc_yesno(getenv("RC_NODEPS"));
+	stop = rc_stringlist_new();
+	start = rc_stringlist_new();
+	types = rc_stringlist_new();
+
+	/* Stopping a service stops whatever needs it, and restarting
+	 * it starts them again */
+	if (do_stop) {
+		rc_stringlist_add(types, "needsme");
+		list = nodeps ? services : rc_deptree_depends(deptree, types,
+		    services, NULL, RC_DEP_TRACE | RC_DEP_STOP);
+		add_state(stop, list, false);
+		if (list != services)
+			rc_stringlist_free(list);
+	}
+	if (do_start && do_stop) {
+		TAILQ_FOREACH(s, stop, entries)
+			rc_stringlist_addu(start, s->value);
+		TAILQ_FOREACH(s, services, entries)
+			rc_stringlist_addu(start, s->value);
+	} else if (do_start) {
+		rc_stringlist_add(types, "ineed");
+		rc_stringlist_add(types, "iwant");
+		list = nodeps ? services : rc_deptree_depends(deptree, types,
+		    services, NULL, RC_DEP_TRACE | RC_DEP_START);
+		add_state(start, list, true);
+		if (list != services)
+			rc_stringlist_free(list);
+	}
+	rc_stringlist_free(types);
+
+	all = rc_stringlist_new();
+	TAILQ_FOREACH(s, stop, entries)
+		rc_stringlist_addu(all, s->value);
+	TAILQ_FOREACH(s, start, entries)
+		rc_stringlist_addu(all, s->value);
+
+	rc_jobs_init();
+	signal_setup(SIGCHLD, handle_signal);
+	max = rc_sched_max(rc_conf_yesno("rc_parallel"));
+
+	if (TAILQ_FIRST(stop)) {
+		rc_sched_init_stop(&queue, deptree, stop);
+		rc_sched_run(&queue, max, false, batch_stop, NULL, false);
+		rc_sched_free(&queue);
+	}
+	if (TAILQ_FIRST(start)) {
+		rc_sched_init_start(&queue, deptree, start);
+		rc_sched_rank(&queue);
+		rc_sched_run(&queue, max, true, batch_start, NULL, true);
+		rc_sched_free(&queue);
+		rc_history_save();
+	}
+
+	TAILQ_FOREACH(s, all, entries) {
+		state = rc_service_state(s->value);
+		if (rc_stringlist_find(start, s->value))
+			ok = state & (RC_SERVICE_STARTED | RC_SERVICE_INACTIVE);
+		else
+			ok = state & RC_SERVICE_STOPPED;
+		if (ok)
+			einfo("%s: %s", s->value,
+			    state & RC_SERVICE_STARTED ? "started" :
+			    state & RC_SERVICE_INACTIVE ? "inactive" :
+			    "stopped");
+		else {
+			eerror("%s: failed to %s", s->value, cmd);
+			retval = EXIT_FAILURE;
+		}
+	}
+
+	signal_setup(SIGCHLD, SIG_DFL);
+	rc_jobs_free();
+	rc_stringlist_free(all);
+	rc_stringlist_free(start);
+	rc_stringlist_free(stop);
+	rc_stringlist_free(services);
+	rc_deptree_free(deptree);
+	return retval;
+}
+
 int main(int argc, char **argv)
 {
 	int opt;
 	char *service;
 	RC_STRINGLIST *list;
 	RC_STRING *s;
-	RC_SERVICE state;
-	bool if_crashed = false;
-	bool if_exists = false;
-	bool if_inactive = false;
-	bool if_notstarted = false;
-	bool if_started = false;
-	bool if_stopped = false;
+	bool do_batch = false;
 
 	applet = basename_c(argv[0]);
 	/* Ensure that we are only quiet when explicitly told to be */
@@ -86,6 +273,9 @@ int main(int argc, char **argv)
 		    longopts, (int *) 0)) != -1)
 	{
 		switch (opt) {
+		case 'b':
+			do_batch = true;
+			break;
 		case 'd':
 			setenv("RC_DEBUG", "yes", 1);
 			break;
@@ -144,6 +334,11 @@ int main(int argc, char **argv)
 
 	argc -= optind;
 	argv += optind;
+	if (do_batch) {
+		if (*argv == NULL)
+			eerrorx("%s: you need to specify a command", applet);
+		return batch(argv[0], argv + 1);
+	}
 	if (*argv == NULL)
 		eerrorx("%s: you need to specify a service", applet);
 	if ((service = rc_service_resolve(*argv)) == NULL) {
@@ -151,16 +346,7 @@ int main(int argc, char **argv)
 			return 0;
 		eerrorx("%s: service `%s' does not exist", applet, *argv);
 	}
-	state = rc_service_state(*argv);
-	if (if_crashed &&  ! (rc_service_daemons_crashed(*argv) && errno != EACCES))
-		return 0;
-	if (if_inactive && ! (state & RC_SERVICE_INACTIVE))
-		return 0;
-	if (if_notstarted && (state & RC_SERVICE_STARTED))
-		return 0;
-	if (if_started && ! (state & RC_SERVICE_STARTED))
-		return 0;
-	if (if_stopped && ! (state & RC_SERVICE_STOPPED))
+	if (!wanted(*argv))
 		return 0;
 	*argv = service;
 	execv(*argv, argv);
@@ -59,6 +59,23 @@ static RC_STRINGLIST *types;
 
 static RC_STRINGLIST *levels, *services, *tmp, *alist;
 static RC_STRINGLIST *sservices, *nservices, *needsme;
+static RC_PROCS *procs;
+
+/* Take one snapshot of the process table for every service we look at,
+ * rather than searching it again for each of them */
+static RC_PROCS *
+snapshot(void)
+{
+	if (!procs)
+		procs = rc_procs_snapshot();
+	return procs;
+}
+
+static RC_SERVICE
+service_state(const char *service)
+{
+	return rc_service_state_in(service, snapshot());
+}
 
 static void
 print_level(const char *prefix, const char *level)
@@ -77,7 +94,7 @@ print_level(const char *prefix, const char *level)
 
 static char *get_uptime(const char *service)
 {
-	RC_SERVICE state = rc_service_state(service);
+	RC_SERVICE state = service_state(service);
 	char *start_count;
 	time_t now;
 	char *start_time_string;
@@ -132,7 +149,7 @@ print_service(const char *service)
 	char *start_time = NULL;
 	int cols =  printf(" %s", service);
 	const char *c = ecolor(ECOLOR_GOOD);
-	RC_SERVICE state = rc_service_state(service);
+	RC_SERVICE state = service_state(service);
 	ECOLOR color = ECOLOR_BAD;
 
 	if (state & RC_SERVICE_STOPPING)
@@ -144,9 +161,7 @@ print_service(const char *service)
 		xasprintf(&status, "inactive ");
 		color = ECOLOR_WARN;
 	} else if (state & RC_SERVICE_STARTED) {
-		errno = 0;
-		if (rc_service_daemons_crashed(service) && errno != EACCES)
-		{
+		if (state & RC_SERVICE_CRASHED) {
 			child_pid = rc_service_value_get(service, "child_pid");
 			start_time = rc_service_value_get(service, "start_time");
 			if (start_time && child_pid)
@@ -255,7 +270,8 @@ int main(int argc, char **argv)
 			services = rc_services_in_state(RC_SERVICE_STARTED);
 			retval = 1;
 			TAILQ_FOREACH(s, services, entries)
-				if (rc_service_daemons_crashed(s->value)) {
+				if (rc_service_daemons_crashed_in(s->value,
+				    snapshot())) {
 					printf("%s\n", s->value);
 					retval = 0;
 				}
@@ -279,7 +295,7 @@ int main(int argc, char **argv)
 					}
 			}
 			TAILQ_FOREACH_SAFE(s, services, entries, t)
-				if (rc_service_state(s->value) &
+				if (service_state(s->value) &
 					(RC_SERVICE_STOPPED | RC_SERVICE_HOTPLUGGED)) {
 					TAILQ_REMOVE(services, s, entries);
 					free(s->value);
@@ -374,7 +390,7 @@ int main(int argc, char **argv)
 		}
 		TAILQ_FOREACH_SAFE(s, services, entries, t) {
 			if ((rc_stringlist_find(sservices, s->value) ||
-			    (rc_service_state(s->value) & ( RC_SERVICE_STOPPED | RC_SERVICE_HOTPLUGGED)))) {
+			    (service_state(s->value) & ( RC_SERVICE_STOPPED | RC_SERVICE_HOTPLUGGED)))) {
 				TAILQ_REMOVE(services, s, entries);
 				free(s->value);
 				free(s);
@@ -421,6 +437,7 @@ exit:
 	rc_stringlist_free(types);
 	rc_stringlist_free(levels);
 	rc_deptree_free(deptree);
+	rc_procs_free(procs);
 
 	return retval;
 }
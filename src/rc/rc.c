@@ -33,7 +33,6 @@ const char rc_copyright[] = "Copyright (c) 2007-2008 Roy Marples";
 #include <dirent.h>
 #include <ctype.h>
 #include <getopt.h>
-#include <libgen.h>
 #include <limits.h>
 #include <pwd.h>
 #include <stdbool.h>
@@ -48,20 +47,26 @@ const char rc_copyright[] = "Copyright (c) 2007-2008 Roy Marples";
 #include "einfo.h"
 #include "queue.h"
 #include "rc.h"
+#include "rc-config.h"
+#include "rc-jobs.h"
 #include "rc-logger.h"
 #include "rc-misc.h"
+#include "rc-plan.h"
 #include "rc-plugin.h"
+#include "rc-readahead.h"
+#include "rc-sched.h"
 
 #include "version.h"
 #include "_usage.h"
 
 const char *extraopts = NULL;
-const char *getoptstring = "a:no:s:S" getoptstring_COMMON;
+const char *getoptstring = "a:no:s:ST" getoptstring_COMMON;
 const struct option longopts[] = {
 	{ "no-stop", 0, NULL, 'n' },
 	{ "override",    1, NULL, 'o' },
 	{ "service",     1, NULL, 's' },
 	{ "sys",         0, NULL, 'S' },
+	{ "simulate",    0, NULL, 'T' },
 	longopts_COMMON
 };
 const char * const longopts_help[] = {
@@ -70,6 +75,8 @@ const char * const longopts_help[] = {
 	"when leaving single user or boot runlevels",
 	"runs the service specified with the rest\nof the arguments",
 	"output the RC system type, if any",
+	"show how long starting the runlevel would\n"
+	"take using recorded start times",
 	longopts_help_COMMON
 };
 const char *usagestring = ""					\
@@ -94,8 +101,6 @@ static RC_HOOK hook_out;
 
 struct termios *termios_orig = NULL;
 
-RC_PIDLIST service_pids;
-
 static void
 clean_failed(void)
 {
@@ -124,9 +129,6 @@ clean_failed(void)
 static void
 cleanup(void)
 {
-	RC_PID *p1 = LIST_FIRST(&service_pids);
-	RC_PID *p2;
-
 	if (!rc_in_logger && !rc_in_plugin &&
 	    applet && (strcmp(applet, "rc") == 0 || strcmp(applet, "openrc") == 0))
 	{
@@ -147,11 +149,8 @@ cleanup(void)
 		rc_logger_close();
 	}
 
-	while (p1) {
-		p2 = LIST_NEXT(p1, entries);
-		free(p1);
-		p1 = p2;
-	}
+	rc_jobs_free();
+	rc_plan_free();
 
 	rc_stringlist_free(main_hotplugged_services);
 	rc_stringlist_free(main_stop_services);
@@ -349,63 +348,18 @@ static char *get_krunlevel(void)
 	return buffer;
 }
 
-static void
-add_pid(pid_t pid)
-{
-	RC_PID *p = xmalloc(sizeof(*p));
-	p->pid = pid;
-	LIST_INSERT_HEAD(&service_pids, p, entries);
-}
-
-static void
-remove_pid(pid_t pid)
-{
-	RC_PID *p;
-
-	LIST_FOREACH(p, &service_pids, entries)
-	    if (p->pid == pid) {
-		    LIST_REMOVE(p, entries);
-		    free(p);
-		    return;
-	    }
-}
-
-static void
-wait_for_services(void)
-{
-	for (;;) {
-		while (waitpid(0, 0, 0) != -1)
-			;
-		if (errno != EINTR)
-			break;
-	}
-}
-
 static void
 handle_signal(int sig)
 {
 	int serrno = errno;
 	char *signame = NULL;
-	pid_t pid;
-	RC_PID *pi;
-	int status = 0;
 	struct winsize ws;
 	sigset_t sset;
 
 	switch (sig) {
 	case SIGCHLD:
-		do {
-			pid = waitpid(-1, &status, WNOHANG);
-			if (pid < 0) {
-				if (errno != ECHILD)
-					eerror("waitpid: %s", strerror(errno));
-				return;
-			}
-		} while (!WIFEXITED(status) && !WIFSIGNALED(status));
-
-		/* Remove that pid from our list */
-		if (pid > 0)
-			remove_pid(pid);
+		/* Our main loop reaps the children */
+		rc_jobs_sigchld();
 		break;
 
 	case SIGWINCH:
@@ -437,8 +391,7 @@ handle_signal(int sig)
 		sigprocmask(SIG_BLOCK, &sset, NULL);
 
 		/* Kill any running services we have started */
-		LIST_FOREACH(pi, &service_pids, entries)
-		    kill(pi->pid, SIGTERM);
+		rc_jobs_signal(SIGTERM);
 
 		/* Notify plugins we are aborting */
 		rc_plugin_run(RC_HOOK_ABORT, NULL);
@@ -496,6 +449,10 @@ do_sysinit()
 	 * sys */
 	if ((sys = rc_sys()))
 		setenv("RC_SYS", sys, 1);
+
+	/* init.sh has restored our caches, so we can start reading ahead */
+	rc_readahead_start();
+
 	/* force an update of the dependency tree */
 	if ((main_deptree = _rc_deptree_load(1, NULL)) == NULL)
 		eerrorx("failed to load deptree");
@@ -505,29 +462,75 @@ static bool
 runlevel_config(const char *service, const char *level)
 {
 	char *init = rc_service_resolve(service);
-	char *conf, *dir;
 	bool retval;
 
-	dir = dirname(init);
-	dir = dirname(init);
-	xasprintf(&conf, "%s/conf.d/%s.%s", dir, service, level);
-	retval = exists(conf);
-	free(conf);
+	if (!init)
+		return false;
+	retval = rc_config_runlevel(init, service, level);
 	free(init);
 	return retval;
 }
 
+static pid_t
+stop_service(const char *service, void *arg _unused)
+{
+	return service_stop(service);
+}
+
+/* Check if any service that is going to be started depends on us.
+ * The answer is remembered in decisions as +service or -service so
+ * it can be cached with the rest of the plan. */
+static bool
+start_needs(RC_STRINGLIST *types_nw, RC_STRINGLIST *start_services,
+    const RC_DEPTREE *deptree, const char *newlevel, const char *service,
+    RC_STRINGLIST *decisions, bool *changed)
+{
+	RC_STRINGLIST *deporder, *tmplist;
+	RC_STRING *svc;
+	char *yes, *no;
+	bool needed = false;
+
+	xasprintf(&yes, "+%s", service);
+	xasprintf(&no, "-%s", service);
+	if (rc_stringlist_find(decisions, yes))
+		needed = true;
+	else if (!rc_stringlist_find(decisions, no)) {
+		tmplist = rc_stringlist_new();
+		rc_stringlist_add(tmplist, service);
+		deporder = rc_deptree_depends(deptree, types_nw,
+		    tmplist, newlevel ? newlevel : runlevel,
+		    RC_DEP_STRICT | RC_DEP_TRACE);
+		rc_stringlist_free(tmplist);
+		TAILQ_FOREACH(svc, deporder, entries) {
+			if (rc_stringlist_find(start_services, svc->value)) {
+				needed = true;
+				break;
+			}
+		}
+		rc_stringlist_free(deporder);
+		rc_stringlist_add(decisions, needed ? yes : no);
+		*changed = true;
+	}
+	free(yes);
+	free(no);
+	return needed;
+}
+
 static void
 do_stop_services(RC_STRINGLIST *types_nw, RC_STRINGLIST *start_services,
 				 const RC_STRINGLIST *stop_services, const RC_DEPTREE *deptree,
-				 const char *newlevel, bool parallel, bool going_down)
+				 const char *newlevel, bool parallel, bool going_down,
+				 const char *plan_key)
 {
-	pid_t pid;
-	RC_STRING *service, *svc1, *svc2;
-	RC_STRINGLIST *deporder, *tmplist, *kwords;
+	RC_STRING *service, *svc1;
+	RC_STRINGLIST *kwords;
 	RC_SERVICE state;
 	RC_STRINGLIST *nostop;
-	bool crashed, nstop;
+	RC_STRINGLIST *stop_list;
+	RC_STRINGLIST *decisions = NULL;
+	struct rc_sched_queue queue;
+	char *plan_name = NULL;
+	bool crashed, nstop, changed = false;
 
 	if (!types_nw) {
 		types_nw = rc_stringlist_new();
@@ -537,7 +540,16 @@ do_stop_services(RC_STRINGLIST *types_nw, RC_STRINGLIST *start_services,
 
 	crashed = rc_conf_yesno("rc_crashed_stop");
 
+	if (plan_key) {
+		xasprintf(&plan_name, "keep:%s:%s",
+		    runlevel, newlevel ? newlevel : runlevel);
+		decisions = rc_plan_get(plan_name, plan_key);
+	}
+	if (!decisions)
+		decisions = rc_stringlist_new();
+
 	nostop = rc_stringlist_split(rc_conf_value("rc_nostop"), " ");
+	stop_list = rc_stringlist_new();
 	TAILQ_FOREACH_REVERSE(service, stop_services, rc_stringlist, entries)
 	{
 		state = rc_service_state(service->value);
@@ -588,106 +600,130 @@ do_stop_services(RC_STRINGLIST *types_nw, RC_STRINGLIST *start_services,
 
 		/* We got this far. Last check is to see if any any service
 		 * that going to be started depends on us */
-		if (!svc1) {
-			tmplist = rc_stringlist_new();
-			rc_stringlist_add(tmplist, service->value);
-			deporder = rc_deptree_depends(deptree, types_nw,
-			    tmplist, newlevel ? newlevel : runlevel,
-			    RC_DEP_STRICT | RC_DEP_TRACE);
-			rc_stringlist_free(tmplist);
-			svc2 = NULL;
-			TAILQ_FOREACH(svc1, deporder, entries) {
-				svc2 = rc_stringlist_find(start_services,
-				    svc1->value);
-				if (svc2)
-					break;
-			}
-			rc_stringlist_free(deporder);
-
-			if (svc2)
-				continue;
-		}
+		if (!svc1 && start_needs(types_nw, start_services, deptree,
+			newlevel, service->value, decisions, &changed))
+			continue;
 
 stop:
 		/* After all that we can finally stop the blighter! */
-		pid = service_stop(service->value);
-		if (pid > 0) {
-			add_pid(pid);
-			if (!parallel) {
-				rc_waitpid(pid);
-				remove_pid(pid);
-			}
-		}
+		rc_stringlist_add(stop_list, service->value);
+	}
+
+	if (plan_name && changed) {
+		rc_plan_set(plan_name, plan_key, decisions);
+		rc_plan_save();
 	}
+	free(plan_name);
+	rc_stringlist_free(decisions);
 
+	/* Stop each service as soon as everything that depends on it
+	 * has stopped */
+	rc_sched_init_stop(&queue, deptree, stop_list);
+	rc_sched_run(&queue, rc_sched_max(parallel), false,
+	    stop_service, NULL, false);
+
+	rc_stringlist_free(stop_list);
 	rc_stringlist_free(nostop);
 }
 
+struct start_ctx {
+	bool interactive;
+	bool crashed;
+};
+
+static pid_t
+start_service(const char *service, void *arg)
+{
+	struct start_ctx *ctx = arg;
+	RC_SERVICE state;
+
+	state = rc_service_state(service);
+	if (state & RC_SERVICE_FAILED)
+		return 0;
+	if (!(state & RC_SERVICE_STOPPED)) {
+		if (ctx->crashed &&
+		    rc_service_daemons_crashed(service))
+			rc_service_mark(service,
+			    RC_SERVICE_STOPPED);
+		else
+			return 0;
+	}
+	if (!ctx->interactive)
+		ctx->interactive = want_interactive();
+
+	if (ctx->interactive) {
+interactive_retry:
+		printf("\n");
+		einfo("About to start the service %s", service);
+		eindent();
+		einfo("1) Start the service\t\t2) Skip the service");
+		einfo("3) Continue boot process\t\t4) Exit to shell");
+		eoutdent();
+interactive_option:
+		switch (read_key(true)) {
+		case '1': break;
+		case '2': return 0;
+		case '3': ctx->interactive = false; break;
+		case '4': open_shell(); goto interactive_retry;
+		default: goto interactive_option;
+		}
+	}
+
+	return service_start(service);
+}
+
+static void
+wait_for_services(bool record)
+{
+	struct rc_job_done done;
+
+	while (rc_jobs_wait(&done, -1)) {
+		if (record)
+			rc_history_record(&done);
+		free(done.service);
+	}
+}
+
 static void
-do_start_services(const RC_STRINGLIST *start_services, bool parallel)
+do_start_services(RC_STRINGLIST *start_services, const RC_DEPTREE *deptree,
+    bool parallel, bool history)
 {
+	struct start_ctx ctx;
+	struct rc_sched_queue queue;
 	RC_STRING *service;
 	pid_t pid;
-	bool interactive = false;
-	RC_SERVICE state;
-	bool crashed = false;
 
+	ctx.interactive = false;
 	if (!rc_yesno(getenv("EINFO_QUIET")))
-		interactive = exists(INTERACTIVE);
+		ctx.interactive = exists(INTERACTIVE);
 	errno = 0;
-	crashed = rc_conf_yesno("rc_crashed_start");
+	ctx.crashed = rc_conf_yesno("rc_crashed_start");
 	if (errno == ENOENT)
-		crashed = true;
-
-	TAILQ_FOREACH(service, start_services, entries) {
-		state = rc_service_state(service->value);
-		if (state & RC_SERVICE_FAILED)
-			continue;
-		if (!(state & RC_SERVICE_STOPPED)) {
-			if (crashed &&
-			    rc_service_daemons_crashed(service->value))
-				rc_service_mark(service->value,
-				    RC_SERVICE_STOPPED);
-			else
-			    continue;
-		}
-		if (!interactive)
-			interactive = want_interactive();
-
-		if (interactive) {
-	interactive_retry:
-			printf("\n");
-			einfo("About to start the service %s",
-			    service->value);
-			eindent();
-			einfo("1) Start the service\t\t2) Skip the service");
-			einfo("3) Continue boot process\t\t4) Exit to shell");
-			eoutdent();
-	interactive_option:
-			switch (read_key(true)) {
-			case '1': break;
-			case '2': continue;
-			case '3': interactive = false; break;
-			case '4': open_shell(); goto interactive_retry;
-			default: goto interactive_option;
-			}
-		}
-
-		pid = service_start(service->value);
-		if (pid == -1)
-			break;
-		/* Remember the pid if we're running in parallel */
-		if (pid > 0) {
-			add_pid(pid);
-			if (!parallel) {
-				rc_waitpid(pid);
-				remove_pid(pid);
+		ctx.crashed = true;
+
+	if (parallel && history) {
+		/* Start whatever is ready and has the longest expected
+		 * chain of services waiting on it first */
+		rc_sched_init_start(&queue, deptree, start_services);
+		rc_sched_rank(&queue);
+		rc_sched_run(&queue, rc_sched_max(parallel), true,
+		    start_service, &ctx, true);
+	} else {
+		TAILQ_FOREACH(service, start_services, entries) {
+			pid = start_service(service->value, &ctx);
+			if (pid == -1)
+				break;
+			/* Remember the pid if we're running in parallel */
+			if (pid > 0) {
+				rc_jobs_add(pid, service->value);
+				if (!parallel)
+					wait_for_services(history);
 			}
 		}
 	}
 
 	/* Store our interactive status for boot */
-	if (interactive &&
+	if (ctx.interactive &&
 	    (strcmp(runlevel, RC_LEVEL_SYSINIT) == 0 ||
 		strcmp(runlevel, getenv("RC_BOOTLEVEL")) == 0))
 		mark_interactive();
@@ -698,6 +734,49 @@ do_start_services(const RC_STRINGLIST *start_services, bool parallel)
 
 }
 
+/* Show how long starting a runlevel would take with the start times we
+ * have recorded, in list order and critical path first. */
+static void
+simulate(const char *level)
+{
+	RC_STRINGLIST *types, *chain, *services, *deporder;
+	RC_STRING *rlevel;
+	struct rc_sched_queue queue;
+	unsigned long list, critical;
+	int max = rc_sched_max(true);
+
+	if (!(main_deptree = rc_deptree_load()))
+		eerrorx("failed to load deptree");
+	types = rc_stringlist_new();
+	rc_stringlist_add(types, "ineed");
+	rc_stringlist_add(types, "iwant");
+	rc_stringlist_add(types, "iuse");
+	rc_stringlist_add(types, "iafter");
+
+	chain = rc_runlevel_stacks(level);
+	TAILQ_FOREACH_REVERSE(rlevel, chain, rc_stringlist, entries) {
+		services = rc_services_in_runlevel(rlevel->value);
+		rc_stringlist_sort(&services);
+		deporder = rc_deptree_depends(main_deptree, types, services,
+		    rlevel->value, RC_DEP_STRICT | RC_DEP_TRACE | RC_DEP_START);
+		rc_stringlist_free(services);
+
+		rc_sched_init_start(&queue, main_deptree, deporder);
+		rc_sched_rank(&queue);
+		list = rc_sched_simulate(&queue, max, false);
+		rc_sched_init_start(&queue, main_deptree, deporder);
+		rc_sched_rank(&queue);
+		critical = rc_sched_simulate(&queue, max, true);
+		rc_stringlist_free(deporder);
+
+		einfo("%s: list order %lu.%03lus, critical path first %lu.%03lus",
+		    rlevel->value, list / 1000, list % 1000,
+		    critical / 1000, critical % 1000);
+	}
+	rc_stringlist_free(chain);
+	rc_stringlist_free(types);
+}
+
 #ifdef RC_DEBUG
 static void
 handle_bad_signal(int sig)
@@ -740,6 +819,11 @@ int main(int argc, char **argv)
 	bool parallel;
 	int regen = 0;
 	bool nostop = false;
+	bool simulation = false;
+	bool history;
+	bool plan_cache;
+	char *plan_key = NULL;
+	char *plan_name = NULL;
 #ifdef __linux__
 	char *proc;
 	char *p;
@@ -753,7 +837,6 @@ int main(int argc, char **argv)
 #endif
 
 	applet = basename_c(argv[0]);
-	LIST_INIT(&service_pids);
 	atexit(cleanup);
 	if (!applet)
 		eerrorx("arguments required");
@@ -814,6 +897,9 @@ int main(int argc, char **argv)
 				printf("%s\n", systype);
 			exit(EXIT_SUCCESS);
 			/* NOTREACHED */
+		case 'T':
+			simulation = true;
+			break;
 		case_RC_COMMON_GETOPT
 		}
 	}
@@ -831,6 +917,12 @@ int main(int argc, char **argv)
 		}
 	}
 
+	if (simulation) {
+		runlevel = rc_runlevel_get();
+		simulate(newlevel ? newlevel : runlevel);
+		exit(EXIT_SUCCESS);
+	}
+
 	/* Enable logging */
 	setenv("EINFO_LOG", "openrc", 1);
 
@@ -866,6 +958,7 @@ int main(int argc, char **argv)
 	rc_plugin_load();
 
 	/* Now we start handling our children */
+	rc_jobs_init();
 	signal_setup(SIGCHLD, handle_signal);
 
 	if (newlevel &&
@@ -914,7 +1007,7 @@ int main(int argc, char **argv)
 	if (going_down) {
 #ifdef __FreeBSD__
 		/* FIXME: we shouldn't have todo this */
-		/* For some reason, wait_for_services waits for the logger
+		/* For some reason, rc_jobs_wait_all waits for the logger
 		 * proccess to finish as well, but only on FreeBSD.
 		 * We cannot allow this so we stop logging now. */
 		rc_logger_close();
@@ -955,29 +1048,48 @@ int main(int argc, char **argv)
 	* in the new or current runlevel so we won't actually be stopping
 	* them all.
 	*/
-	main_stop_services = rc_services_in_state(RC_SERVICE_STARTED);
-	tmplist = rc_services_in_state(RC_SERVICE_INACTIVE);
-	TAILQ_CONCAT(main_stop_services, tmplist, entries);
-	free(tmplist);
-	tmplist = rc_services_in_state(RC_SERVICE_STARTING);
-	TAILQ_CONCAT(main_stop_services, tmplist, entries);
-	free(tmplist);
-	if (main_stop_services)
-		rc_stringlist_sort(&main_stop_services);
-
 	main_types_nwua = rc_stringlist_new();
 	rc_stringlist_add(main_types_nwua, "ineed");
 	rc_stringlist_add(main_types_nwua, "iwant");
 	rc_stringlist_add(main_types_nwua, "iuse");
 	rc_stringlist_add(main_types_nwua, "iafter");
 
-	if (main_stop_services) {
-		tmplist = rc_deptree_depends(main_deptree, main_types_nwua, main_stop_services,
-		    runlevel, depoptions | RC_DEP_STOP);
-		rc_stringlist_free(main_stop_services);
-		main_stop_services = tmplist;
+	/* If nothing has changed since we last made this transition we can
+	 * reuse the orders we worked out then. */
+	errno = 0;
+	plan_cache = rc_conf_yesno("rc_plan_cache");
+	if (errno == ENOENT)
+		plan_cache = true;
+	if (plan_cache) {
+		plan_key = rc_plan_fingerprint(runlevel,
+		    newlevel ? newlevel : runlevel);
+		xasprintf(&plan_name, "stop:%s:%s",
+		    runlevel, newlevel ? newlevel : runlevel);
+		main_stop_services = rc_plan_get(plan_name, plan_key);
 	}
 
+	if (!main_stop_services) {
+		main_stop_services = rc_services_in_state(RC_SERVICE_STARTED);
+		tmplist = rc_services_in_state(RC_SERVICE_INACTIVE);
+		TAILQ_CONCAT(main_stop_services, tmplist, entries);
+		free(tmplist);
+		tmplist = rc_services_in_state(RC_SERVICE_STARTING);
+		TAILQ_CONCAT(main_stop_services, tmplist, entries);
+		free(tmplist);
+		if (main_stop_services)
+			rc_stringlist_sort(&main_stop_services);
+
+		if (main_stop_services) {
+			tmplist = rc_deptree_depends(main_deptree, main_types_nwua, main_stop_services,
+			    runlevel, depoptions | RC_DEP_STOP);
+			rc_stringlist_free(main_stop_services);
+			main_stop_services = tmplist;
+		}
+		if (plan_key)
+			rc_plan_set(plan_name, plan_key, main_stop_services);
+	}
+	free(plan_name);
+
 	/* Create a list of all services which should be started for the new or
 	 * current runlevel including those in boot, sysinit and hotplugged
 	 * runlevels.  Clearly, some of these will already be started so we
@@ -1014,13 +1126,16 @@ int main(int argc, char **argv)
 	}
 
 	parallel = rc_conf_yesno("rc_parallel");
+	history = rc_conf_yesno("rc_start_history");
 
 	/* Now stop the services that shouldn't be running */
 	if (main_stop_services && !nostop)
-		do_stop_services(main_types_nw, main_start_services, main_stop_services, main_deptree, newlevel, parallel, going_down);
+		do_stop_services(main_types_nw, main_start_services, main_stop_services, main_deptree, newlevel, parallel, going_down, plan_key);
+	rc_plan_save();
+	free(plan_key);
 
 	/* Wait for our services to finish */
-	wait_for_services();
+	rc_jobs_wait_all();
 
 	/* Notify the plugins we have finished */
 	rc_plugin_run(RC_HOOK_RUNLEVEL_STOP_OUT,
@@ -1074,18 +1189,38 @@ int main(int argc, char **argv)
 		RC_STRING *rlevel;
 		TAILQ_FOREACH_REVERSE(rlevel, runlevel_chain, rc_stringlist, entries)
 		{
-			/* Get a list of all the services in that runlevel */
-			RC_STRINGLIST *run_services = rc_services_in_runlevel(rlevel->value);
+			RC_STRINGLIST *run_services = NULL;
+
+			if (plan_cache) {
+				plan_key = rc_plan_fingerprint(runlevel, rlevel->value);
+				xasprintf(&plan_name, "start:%s:%s", runlevel, rlevel->value);
+				run_services = rc_plan_get(plan_name, plan_key);
+			}
+
+			if (!run_services) {
+				/* Get a list of all the services in that runlevel */
+				run_services = rc_services_in_runlevel(rlevel->value);
+
+				rc_stringlist_sort(&run_services);
+				deporder = rc_deptree_depends(main_deptree, main_types_nwua, run_services, rlevel->value, depoptions | RC_DEP_START);
+				rc_stringlist_free(run_services);
+				run_services = deporder;
+				if (plan_key) {
+					rc_plan_set(plan_name, plan_key, run_services);
+					rc_plan_save();
+				}
+			}
+			free(plan_key);
+			free(plan_name);
+			plan_key = plan_name = NULL;
 
 			/* Start those services. */
-			rc_stringlist_sort(&run_services);
-			deporder = rc_deptree_depends(main_deptree, main_types_nwua, run_services, rlevel->value, depoptions | RC_DEP_START);
-			rc_stringlist_free(run_services);
-			run_services = deporder;
-			do_start_services(run_services, parallel);
+			do_start_services(run_services, main_deptree, parallel, history);
 
 			/* Wait for our services to finish */
-			wait_for_services();
+			wait_for_services(history);
+			if (history)
+				rc_history_save();
 
 			/* Free the list of services, we're done with it. */
 			rc_stringlist_free(run_services);
@@ -1109,6 +1244,11 @@ int main(int argc, char **argv)
 	rc_plugin_run(RC_HOOK_RUNLEVEL_START_OUT, runlevel);
 	hook_out = 0;
 
+	/* We have finished booting, so stop recording what we read */
+	if (strcmp(runlevel, RC_LEVEL_SYSINIT) != 0 &&
+	    strcmp(runlevel, bootlevel) != 0)
+		rc_readahead_stop();
+
 	/* If we're in the boot runlevel and we regenerated our dependencies
 	 * we need to delete them so that they are regenerated again in the
 	 * default runlevel as they may depend on things that are now
@@ -23,6 +23,7 @@
 
 #include <sys/types.h>
 #include <sys/ioctl.h>
+#include <sys/param.h>
 #include <sys/resource.h>
 #include <sys/stat.h>
 #include <termios.h>
@@ -59,6 +60,7 @@ static struct pam_conv conv = { NULL, NULL};
 #include "queue.h"
 #include "rc.h"
 #include "rc-misc.h"
+#include "rc-notify.h"
 #include "rc-pipes.h"
 #include "rc-schedules.h"
 #include "_usage.h"
@@ -66,7 +68,7 @@ static struct pam_conv conv = { NULL, NULL};
 
 const char *applet = NULL;
 const char *extraopts = NULL;
-const char *getoptstring = "I:KN:PR:Sa:bc:d:e:g:ik:mn:op:s:tu:r:w:x:1:2:3:4:" \
+const char *getoptstring = "G:I:KN:PR:Sa:bc:d:e:g:ik:mn:op:s:tu:r:w:x:1:2:3:4:5:6:7:8:9:" \
 	getoptstring_COMMON;
 const struct option longopts[] = {
 	{ "ionice",       1, NULL, 'I'},
@@ -96,6 +98,12 @@ const struct option longopts[] = {
 	{ "stderr",       1, NULL, '2'},
 	{ "stdout-logger",1, NULL, '3'},
 	{ "stderr-logger",1, NULL, '4'},
+	{ "cgroup",       1, NULL, '5'},
+	{ "cgroup-settings",1, NULL, 'G'},
+	{ "notify",       1, NULL, '6'},
+	{ "notify-timeout",1, NULL, '7'},
+	{ "wait-pidfile", 1, NULL, '8'},
+	{ "manifest",     1, NULL, '9'},
 	{ "progress",     0, NULL, 'P'},
 	longopts_COMMON
 };
@@ -127,6 +135,12 @@ const char * const longopts_help[] = {
 	"Redirect stderr to file",
 	"Redirect stdout to process",
 	"Redirect stderr to process",
+	"Start the daemon in, or stop everything in, this cgroup2 directory",
+	"Settings to write to the cgroup, one \"file value\" per line",
+	"Wait for the daemon to signal readiness on fd:N or socket",
+	"Seconds to wait for readiness",
+	"Milliseconds to wait for a running pid in the pidfile",
+	"Start every daemon listed in this file, - for stdin",
 	"Print dots each second while waiting",
 	longopts_help_COMMON
 };
@@ -136,8 +150,37 @@ static char **nav;
 
 static char *changeuser, *ch_root, *ch_dir;
 
+/* Set in the children --manifest starts, which leave the check that
+ * the daemon is still running to the parent */
+static bool batch = false;
+
+/* How many daemons --manifest starts at once */
+#define MANIFEST_JOBS 16
+
+/* Users and groups are looked up once for every daemon in a manifest */
+struct id_entry {
+	char *name;
+	bool group;
+	struct passwd pw;
+	struct group gr;
+	LIST_ENTRY(id_entry) entries;
+};
+static LIST_HEAD(, id_entry) id_cache = LIST_HEAD_INITIALIZER(id_cache);
+
+struct launch {
+	char *svcname;
+	int argc;
+	char **argv;
+	char *line;
+	char *words;
+	pid_t pid;
+	bool ok;
+};
+
 extern char **environ;
 
+static int start_stop_daemon(int argc, char **argv);
+
 #if !defined(SYS_ioprio_set) && defined(__NR_ioprio_set)
 # define SYS_ioprio_set __NR_ioprio_set
 #endif
@@ -157,9 +200,86 @@ static inline int ioprio_set(int which _unused,
 static void
 cleanup(void)
 {
+	struct id_entry *e;
+
 	free(changeuser);
 	free(nav);
 	free_schedulelist();
+	while ((e = LIST_FIRST(&id_cache))) {
+		LIST_REMOVE(e, entries);
+		free(e->name);
+		free(e->pw.pw_name);
+		free(e->pw.pw_dir);
+		free(e->gr.gr_name);
+		free(e);
+	}
+}
+
+static struct id_entry *
+id_find(const char *name, bool group)
+{
+	struct id_entry *e;
+
+	LIST_FOREACH(e, &id_cache, entries)
+		if (e->group == group && strcmp(e->name, name) == 0)
+			return e;
+	e = xmalloc(sizeof(*e));
+	memset(e, 0, sizeof(*e));
+	e->name = xstrdup(name);
+	e->group = group;
+	return e;
+}
+
+/* getpwnam, or getpwuid if name is a number, remembering the answer */
+static struct passwd *
+lookup_user(const char *name)
+{
+	struct id_entry *e = id_find(name, false);
+	struct passwd *pw;
+	int id;
+
+	if (e->pw.pw_name)
+		return &e->pw;
+	if (sscanf(name, "%d", &id) == 1)
+		pw = getpwuid((uid_t)id);
+	else
+		pw = getpwnam(name);
+	if (!pw) {
+		free(e->name);
+		free(e);
+		return NULL;
+	}
+	e->pw.pw_name = xstrdup(pw->pw_name);
+	e->pw.pw_dir = pw->pw_dir ? xstrdup(pw->pw_dir) : NULL;
+	e->pw.pw_uid = pw->pw_uid;
+	e->pw.pw_gid = pw->pw_gid;
+	LIST_INSERT_HEAD(&id_cache, e, entries);
+	return &e->pw;
+}
+
+/* getgrnam, or getgrgid if name is a number, remembering the answer */
+static struct group *
+lookup_group(const char *name)
+{
+	struct id_entry *e = id_find(name, true);
+	struct group *gr;
+	int id;
+
+	if (e->gr.gr_name)
+		return &e->gr;
+	if (sscanf(name, "%d", &id) == 1)
+		gr = getgrgid((gid_t)id);
+	else
+		gr = getgrnam(name);
+	if (!gr) {
+		free(e->name);
+		free(e);
+		return NULL;
+	}
+	e->gr.gr_name = xstrdup(gr->gr_name);
+	e->gr.gr_gid = gr->gr_gid;
+	LIST_INSERT_HEAD(&id_cache, e, entries);
+	return &e->gr;
 }
 
 static void
@@ -245,7 +365,265 @@ expand_home(const char *home, const char *path)
 	return nh;
 }
 
+static void
+reset_getopt(void)
+{
+#if defined(BSD) && !defined(__GNU__)
+	optreset = 1;
+	optind = 1;
+#else
+	optind = 0;
+#endif
+}
+
+/* Split a manifest line into words in place. Quotes group words, but
+ * nothing is expanded. */
+static char **
+manifest_words(char *line, int *count)
+{
+	char **words = NULL;
+	char *p = line, *w, *out, quote;
+	int n = 0;
+
+	for (;;) {
+		p += strspn(p, " \t");
+		if (!*p || *p == '#')
+			break;
+		w = out = p;
+		quote = '\0';
+		while (*p && (quote || (*p != ' ' && *p != '\t'))) {
+			if (quote && *p == quote) {
+				quote = '\0';
+				p++;
+			} else if (!quote && (*p == '\'' || *p == '"'))
+				quote = *p++;
+			else
+				*out++ = *p++;
+		}
+		if (*p)
+			p++;
+		*out = '\0';
+		words = xrealloc(words, sizeof(char *) * (n + 2));
+		words[n++] = w;
+	}
+	if (words)
+		words[n] = NULL;
+	*count = n;
+	return words;
+}
+
+/*
+ * Each line of a manifest is a service name, or - for none, followed by
+ * the options start-stop-daemon --start would take to start its daemon.
+ * Every line is run through start_stop_daemon again, so options that
+ * stop, signal, nest another manifest or only print something are
+ * refused here.
+ */
+static struct launch *
+read_manifest(const char *manifest, int *count)
+{
+	static char start_opt[] = "--start";
+	static const char refused[] = "KRs9hV";
+	FILE *fp;
+	struct launch *l = NULL;
+	char *line = NULL, *copy, **words;
+	size_t len = 0;
+	int n = 0, nwords, i, opt;
+
+	if (strcmp(manifest, "-") == 0)
+		fp = stdin;
+	else if (!(fp = fopen(manifest, "re")))
+		eerrorx("%s: %s: %s", applet, manifest, strerror(errno));
+	while (getline(&line, &len, fp) != -1) {
+		line[strcspn(line, "\n")] = '\0';
+		copy = xstrdup(line);
+		words = manifest_words(copy, &nwords);
+		if (nwords < 2) {
+			if (nwords == 1)
+				eerrorx("%s: %s: nothing to start for `%s'",
+				    applet, manifest, words[0]);
+			free(words);
+			free(copy);
+			continue;
+		}
+		l = xrealloc(l, sizeof(*l) * (n + 1));
+		l[n].line = xstrdup(line);
+		l[n].words = copy;
+		l[n].svcname = strcmp(words[0], "-") == 0 ? NULL : words[0];
+		l[n].argc = nwords + 1;
+		l[n].argv = xmalloc(sizeof(char *) * (nwords + 2));
+		l[n].argv[0] = xstrdup(applet);
+		l[n].argv[1] = start_opt;
+		for (i = 1; i < nwords; i++)
+			l[n].argv[i + 1] = words[i];
+		l[n].argv[nwords + 1] = NULL;
+		opterr = 0;
+		reset_getopt();
+		while ((opt = getopt_long(l[n].argc, l[n].argv,
+		    getoptstring, longopts, NULL)) != -1)
+		{
+			if (opt == '?' || strchr(refused, opt))
+				eerrorx("%s: %s: `%s' may only hold options"
+				    " for --start", applet, manifest, line);
+		}
+		opterr = 1;
+		l[n].pid = 0;
+		l[n].ok = false;
+		free(words);
+		n++;
+	}
+	free(line);
+	if (fp != stdin)
+		fclose(fp);
+	*count = n;
+	return l;
+}
+
+/* Wait for one of the daemons a manifest is starting and note how it
+ * went. Returns 1 once one is reaped, 0 when none are left. */
+static int
+manifest_reap(struct launch *l, int count)
+{
+	pid_t pid;
+	int i, status;
+
+	for (;;) {
+		if ((pid = waitpid(-1, &status, 0)) == -1) {
+			if (errno == EINTR)
+				continue;
+			return 0;
+		}
+		/* We may have been exec'd with children of our own */
+		for (i = 0; i < count; i++)
+			if (l[i].pid == pid) {
+				l[i].ok = WIFEXITED(status) &&
+				    WEXITSTATUS(status) == 0;
+				return 1;
+			}
+	}
+}
+
+/*
+ * Start every daemon in a manifest from this one process. Users, groups
+ * and rc.conf are loaded here once and every child inherits them. The
+ * daemons start in parallel, MANIFEST_JOBS at a time, each with the
+ * same code as a single --start, and we then wait once and check them all in one snapshot of
+ * the process table.
+ */
+static int
+run_manifest(const char *manifest, unsigned int start_wait)
+{
+	struct launch *l;
+	RC_PROCS *procs;
+	struct timespec ts;
+	char *p, *user;
+	int count, i, opt, running = 0;
+	int retval = EXIT_SUCCESS;
+
+	l = read_manifest(manifest, &count);
+
+	opterr = 0;
+	for (i = 0; i < count; i++) {
+		reset_getopt();
+		while ((opt = getopt_long(l[i].argc, l[i].argv,
+		    getoptstring, longopts, NULL)) != -1)
+		{
+			if (opt == 'g')
+				lookup_group(optarg);
+			else if (opt == 'u' || opt == 'c') {
+				p = user = xstrdup(optarg);
+				lookup_user(strsep(&p, ":"));
+				if (p)
+					lookup_group(strsep(&p, ":"));
+				free(user);
+			}
+		}
+	}
+	opterr = 1;
+	endpwent();
+	endgrent();
+
+	if (start_wait == 0 &&
+	    ((p = getenv("SSD_STARTWAIT")) ||
+		(p = rc_conf_value("rc_start_wait"))))
+	{
+		if (sscanf(p, "%u", &start_wait) != 1)
+			start_wait = 0;
+	}
+
+	for (i = 0; i < count; i++) {
+		if (running == MANIFEST_JOBS)
+			running -= manifest_reap(l, count);
+		if ((l[i].pid = fork()) == -1)
+			eerrorx("%s: fork: %s", applet, strerror(errno));
+		if (l[i].pid == 0) {
+			/* Start from what a fresh start-stop-daemon would
+			 * have, keeping only the users and groups we found */
+			batch = true;
+			changeuser = NULL;
+			nav = NULL;
+			ch_root = ch_dir = NULL;
+			if (l[i].svcname)
+				setenv("RC_SVCNAME", l[i].svcname, 1);
+			else
+				unsetenv("RC_SVCNAME");
+			reset_getopt();
+			exit(start_stop_daemon(l[i].argc, l[i].argv));
+		}
+		running++;
+	}
+	while (running > 0)
+		running -= manifest_reap(l, count);
+
+	for (i = 0; i < count; i++) {
+		if (!l[i].ok) {
+			eerror("%s: failed to start `%s'", applet, l[i].line);
+			retval = EXIT_FAILURE;
+		}
+	}
+
+	/* Only daemons recorded against a service can be checked */
+	if (start_wait > 0) {
+		ts.tv_sec = start_wait / 1000;
+		ts.tv_nsec = (start_wait % 1000) * ONE_MS;
+		nanosleep(&ts, NULL);
+		procs = rc_procs_snapshot();
+		for (i = 0; i < count; i++) {
+			if (!l[i].ok || !l[i].svcname ||
+			    !rc_service_daemons_crashed_in(l[i].svcname, procs))
+				continue;
+			eerror("%s: %s died", applet, l[i].svcname);
+			retval = EXIT_FAILURE;
+		}
+		rc_procs_free(procs);
+	}
+
+	for (i = 0; i < count; i++) {
+		free(l[i].argv[0]);
+		free(l[i].argv);
+		free(l[i].line);
+		free(l[i].words);
+	}
+	free(l);
+	return retval;
+}
+
 int main(int argc, char **argv)
+{
+	applet = basename_c(argv[0]);
+	atexit(cleanup);
+
+	signal_setup(SIGINT, handle_signal);
+	signal_setup(SIGQUIT, handle_signal);
+	signal_setup(SIGTERM, handle_signal);
+
+	return start_stop_daemon(argc, argv);
+}
+
+/* Everything one start-stop-daemon does, which --manifest runs again
+ * in a child for every daemon it starts */
+static int
+start_stop_daemon(int argc, char **argv)
 {
 	int devnull_fd = -1;
 #ifdef TIOCNOTTY
@@ -278,11 +656,15 @@ int main(int argc, char **argv)
 	uid_t uid = 0;
 	gid_t gid = 0;
 	char *home = NULL;
-	int tid = 0;
 	char *redirect_stderr = NULL;
 	char *redirect_stdout = NULL;
 	char *stderr_process = NULL;
 	char *stdout_process = NULL;
+	char *cgroup = NULL;
+	char *cgroup_settings = NULL;
+	int cgroup_fd = -1;
+	struct notify notify = { NOTIFY_NONE, -1, -1, -1, NULL, NULL, 0 };
+	int notify_timeout = RC_NOTIFY_TIMEOUT;
 	int stdin_fd;
 	int stdout_fd;
 	int stderr_fd;
@@ -304,13 +686,8 @@ int main(int argc, char **argv)
 	mode_t numask = 022;
 	char **margv;
 	unsigned int start_wait = 0;
-
-	applet = basename_c(argv[0]);
-	atexit(cleanup);
-
-	signal_setup(SIGINT, handle_signal);
-	signal_setup(SIGQUIT, handle_signal);
-	signal_setup(SIGTERM, handle_signal);
+	int wait_pidfile = 0;
+	char *manifest = NULL;
 
 	if ((tmp = getenv("SSD_NICELEVEL")))
 		if (sscanf(tmp, "%d", &nicelevel) != 1)
@@ -392,11 +769,7 @@ int main(int argc, char **argv)
 			p = optarg;
 			tmp = strsep(&p, ":");
 			changeuser = xstrdup(tmp);
-			if (sscanf(tmp, "%d", &tid) != 1)
-				pw = getpwnam(tmp);
-			else
-				pw = getpwuid((uid_t)tid);
-
+			pw = lookup_user(tmp);
 			if (pw == NULL)
 				eerrorx("%s: user `%s' not found",
 				    applet, tmp);
@@ -413,11 +786,7 @@ int main(int argc, char **argv)
 
 			if (p) {
 				tmp = strsep (&p, ":");
-				if (sscanf(tmp, "%d", &tid) != 1)
-					gr = getgrnam(tmp);
-				else
-					gr = getgrgid((gid_t) tid);
-
+				gr = lookup_group(tmp);
 				if (gr == NULL)
 					eerrorx("%s: group `%s'"
 					    " not found",
@@ -436,10 +805,7 @@ int main(int argc, char **argv)
 			break;
 
 		case 'g':  /* --group <group>|<gid> */
-			if (sscanf(optarg, "%d", &tid) != 1)
-				gr = getgrnam(optarg);
-			else
-				gr = getgrgid((gid_t)tid);
+			gr = lookup_group(optarg);
 			if (gr == NULL)
 				eerrorx("%s: group `%s' not found",
 				    applet, optarg);
@@ -516,6 +882,38 @@ int main(int argc, char **argv)
 			stderr_process = optarg;
 			break;
 
+		case '5':  /* --cgroup <directory> */
+			cgroup = optarg;
+			break;
+
+		case 'G':  /* --cgroup-settings <settings> */
+			cgroup_settings = optarg;
+			break;
+
+		case '6':  /* --notify fd:N|socket */
+			if (!rc_notify_parse(&notify, optarg))
+				eerrorx("%s: invalid notify type `%s'",
+				    applet, optarg);
+			break;
+
+		case '7':  /* --notify-timeout <seconds> */
+			if (sscanf(optarg, "%d", &notify_timeout) != 1 ||
+			    notify_timeout < 1)
+				eerrorx("%s: invalid notify timeout `%s'",
+				    applet, optarg);
+			break;
+
+		case '9':  /* --manifest <file> */
+			manifest = optarg;
+			break;
+
+		case '8':  /* --wait-pidfile <milliseconds> */
+			if (sscanf(optarg, "%d", &wait_pidfile) != 1 ||
+			    wait_pidfile < 1)
+				eerrorx("%s: invalid pidfile timeout `%s'",
+				    applet, optarg);
+			break;
+
 		case_RC_COMMON_GETOPT
 		}
 
@@ -523,6 +921,12 @@ int main(int argc, char **argv)
 	argc -= optind;
 	argv += optind;
 
+	if (manifest) {
+		if (batch || start || stop || sig != -1 || *argv)
+			eerrorx("%s: --manifest only takes --wait", applet);
+		exit(run_manifest(manifest, start_wait));
+	}
+
 	/* Allow start-stop-daemon --signal HUP --exec /usr/sbin/dnsmasq
 	 * instead of forcing --stop --oknodo as well */
 	if (!start &&
@@ -555,9 +959,9 @@ int main(int argc, char **argv)
 	if (stop || sig != -1) {
 		if (sig == -1)
 			sig = SIGTERM;
-		if (!*argv && !pidfile && !name && !uid)
+		if (!*argv && !pidfile && !name && !uid && !cgroup)
 			eerrorx("%s: --stop needs --exec, --pidfile,"
-			    " --name or --user", applet);
+			    " --name, --user or --cgroup", applet);
 		if (background)
 			eerrorx("%s: --background is only relevant with"
 			    " --start", applet);
@@ -573,6 +977,12 @@ int main(int argc, char **argv)
 		if (start_wait)
 			ewarn("using --wait with --stop has no effect,"
 			    " use --retry instead");
+		if (notify.type != NOTIFY_NONE)
+			eerrorx("%s: --notify is only relevant with"
+			    " --start", applet);
+		if (wait_pidfile)
+			eerrorx("%s: --wait-pidfile is only relevant with"
+			    " --start", applet);
 	} else {
 		if (!exec)
 			eerrorx("%s: nothing to start", applet);
@@ -591,6 +1001,18 @@ int main(int argc, char **argv)
 		if (redirect_stderr && stderr_process)
 			eerrorx("%s: do not use --stderr and --stderr-logger together",
 					applet);
+		if (start_wait && notify.type != NOTIFY_NONE)
+			eerrorx("%s: do not use --wait and --notify together",
+			    applet);
+		if (wait_pidfile && !pidfile)
+			eerrorx("%s: --wait-pidfile is only relevant with"
+			    " --pidfile", applet);
+		if (wait_pidfile && makepidfile)
+			eerrorx("%s: --wait-pidfile is not relevant with"
+			    " --make-pidfile", applet);
+		if (start_wait && wait_pidfile)
+			eerrorx("%s: do not use --wait and --wait-pidfile"
+			    " together", applet);
 	}
 
 	/* Expand ~ */
@@ -694,7 +1116,7 @@ int main(int argc, char **argv)
 			pid = 0;
 		}
 		i = run_stop_schedule(applet, exec, (const char *const *)margv,
-		    pid, uid, test, progress, false);
+		    pid, uid, cgroup, test, progress, false);
 
 		if (i < 0)
 			/* We failed to stop something */
@@ -763,7 +1185,15 @@ int main(int argc, char **argv)
 	if (background)
 		signal_setup(SIGCHLD, handle_signal);
 
-	if ((pid = fork()) == -1)
+	if (cgroup &&
+	    (cgroup_fd = rc_cgroup_open(cgroup, cgroup_settings)) == -1)
+		eerrorx("%s: %s: %s", applet, cgroup, strerror(errno));
+
+	if (!rc_notify_open(&notify, uid ? uid : geteuid()))
+		eerrorx("%s: unable to set up notification: %s",
+		    applet, strerror(errno));
+
+	if ((pid = rc_cgroup_fork(cgroup_fd)) == -1)
 		eerrorx("%s: fork: %s", applet, strerror(errno));
 
 	/* Child process - lets go! */
@@ -944,8 +1374,12 @@ int main(int argc, char **argv)
 				|| rc_yesno(getenv("EINFO_QUIET")))
 			dup2(stderr_fd, STDERR_FILENO);
 
-		for (i = getdtablesize() - 1; i >= 3; --i)
-			close(i);
+		rc_notify_child(&notify);
+		if (notify.target != -1) {
+			close_fds(3, notify.target - 1, false);
+			close_fds(notify.target + 1, -1, false);
+		} else
+			close_fds(3, -1, false);
 
 		setsid();
 		execvp(exec, argv);
@@ -958,6 +1392,8 @@ int main(int argc, char **argv)
 	}
 
 	/* Parent process */
+	if (cgroup_fd != -1)
+		close(cgroup_fd);
 	if (!background) {
 		/* As we're not backgrounding the process, wait for our pid
 		 * to return */
@@ -979,9 +1415,39 @@ int main(int argc, char **argv)
 		pid = spid;
 	}
 
+	/* A daemon that tells us when it is ready needs no guessing below.
+	 * Only a backgrounded daemon is our child, so only then do we know
+	 * which process to watch. */
+	if (notify.type != NOTIFY_NONE) {
+		i = rc_notify_wait(&notify, notify_timeout * 1000,
+		    background ? pid : 0);
+		rc_notify_close(&notify);
+		/* We record nothing for a daemon that fails here, so
+		 * nothing could stop it later */
+		if (i == 0 && background)
+			kill(pid, SIGTERM);
+		if (i == 0)
+			eerrorx("%s: %s did not signal readiness within"
+			    " %d seconds", applet, exec, notify_timeout);
+		if (i == -1)
+			eerrorx("%s: %s died before signalling readiness",
+			    applet, exec);
+	}
+
+	/* Rather than sleeping and hoping, watch for the daemon to write
+	 * its pidfile */
+	if (wait_pidfile) {
+		spid = get_pid_wait(applet, pidfile, wait_pidfile,
+		    background ? pid : 0);
+		if (spid == -1)
+			eerrorx("%s: %s did not write a running pid to `%s'",
+			    applet, exec, pidfile);
+	}
+
 	/* Wait a little bit and check that process is still running
 	   We do this as some badly written daemons fork and then barf */
-	if (start_wait == 0 &&
+	if (start_wait == 0 && !batch &&
+	    notify.type == NOTIFY_NONE && !wait_pidfile &&
 	    ((p = getenv("SSD_STARTWAIT")) ||
 		(p = rc_conf_value("rc_start_wait"))))
 	{
@@ -989,37 +1455,69 @@ int main(int argc, char **argv)
 			start_wait = 0;
 	}
 
-	if (start_wait > 0) {
-		struct timespec ts;
+	if (start_wait > 0 && !batch) {
+		struct timespec ts, end, now;
+		pid_t dead = -1;
+		long left;
 		bool alive = false;
 
-		ts.tv_sec = start_wait / 1000;
-		ts.tv_nsec = (start_wait % 1000) * ONE_MS;
-		if (nanosleep(&ts, NULL) == -1) {
-			if (errno == EINTR)
-				eerror("%s: caught an interrupt", applet);
-			else {
-				eerror("%s: nanosleep: %s",
-				    applet, strerror(errno));
-				return 0;
+		/* Watch the process we know of, so we hear at once if it
+		 * dies. Only without a pidfile do we have to sleep and then
+		 * look for the daemon in the process table. */
+		if (background)
+			alive = pid_alive_for(pid, start_wait, true);
+		else if (pidfile) {
+			/* The daemon may replace the pid in its pidfile when
+			 * it forks again, so when the pid we watch exits we
+			 * wait out the window for the pidfile to name another
+			 * one, and read it again at the end */
+			clock_gettime(CLOCK_MONOTONIC, &end);
+			end.tv_sec += start_wait / 1000;
+			end.tv_nsec += (start_wait % 1000) * ONE_MS;
+			if (end.tv_nsec >= 1000000000L) {
+				end.tv_sec++;
+				end.tv_nsec -= 1000000000L;
 			}
-		}
-		if (background) {
-			if (kill(pid, 0) == 0)
-				alive = true;
+			for (left = start_wait; left > 0; ) {
+				spid = get_pid_wait(applet, pidfile, left, 0);
+				if (spid == -1)
+					break;
+				if (spid == dead) {
+					/* Exited, but still named there */
+					ts.tv_sec = 0;
+					ts.tv_nsec = (left < 20 ? left : 20) *
+					    ONE_MS;
+					nanosleep(&ts, NULL);
+				} else if (pid_alive_for(spid, left, false))
+					break;
+				dead = spid;
+				clock_gettime(CLOCK_MONOTONIC, &now);
+				left = (end.tv_sec - now.tv_sec) * 1000 +
+				    (end.tv_nsec - now.tv_nsec) / ONE_MS;
+			}
+			pid = get_pid(applet, pidfile);
+			if (pid == -1) {
+				eerrorx("%s: did not "
+				    "create a valid"
+				    " pid in `%s'",
+				    applet, pidfile);
+			}
+			alive = pid_alive_for(pid, 0, false);
 		} else {
-			if (pidfile) {
-				pid = get_pid(applet, pidfile);
-				if (pid == -1) {
-					eerrorx("%s: did not "
-					    "create a valid"
-					    " pid in `%s'",
-					    applet, pidfile);
+			ts.tv_sec = start_wait / 1000;
+			ts.tv_nsec = (start_wait % 1000) * ONE_MS;
+			if (nanosleep(&ts, NULL) == -1) {
+				if (errno == EINTR)
+					eerror("%s: caught an interrupt",
+					    applet);
+				else {
+					eerror("%s: nanosleep: %s",
+					    applet, strerror(errno));
+					return 0;
 				}
-			} else
-				pid = 0;
+			}
 			if (do_stop(applet, exec, (const char *const *)margv,
-				pid, uid, 0, test, false) > 0)
+				0, uid, 0, test, false) > 0)
 				alive = true;
 		}
 
@@ -1027,9 +1525,12 @@ int main(int argc, char **argv)
 			eerrorx("%s: %s died", applet, exec);
 	}
 
-	if (svcname)
+	if (svcname) {
 		rc_service_daemon_set(svcname, exec,
 		    (const char *const *)margv, pidfile, true);
+		if (cgroup)
+			rc_service_value_set(svcname, "cgroup", cgroup);
+	}
 
 	exit(EXIT_SUCCESS);
 	/* NOTREACHED */
@@ -18,7 +18,6 @@
 
 /* nano seconds */
 #define POLL_INTERVAL   20000000
-#define WAIT_PIDFILE   500000000
 #define ONE_SECOND    1000000000
 #define ONE_MS           1000000
 
@@ -61,13 +60,14 @@ static struct pam_conv conv = { NULL, NULL};
 #include "queue.h"
 #include "rc.h"
 #include "rc-misc.h"
+#include "rc-notify.h"
 #include "rc-schedules.h"
 #include "_usage.h"
 #include "helpers.h"
 
 const char *applet = NULL;
 const char *extraopts = NULL;
-const char *getoptstring = "D:d:e:g:I:Kk:m:N:p:R:r:Su:1:2:3" \
+const char *getoptstring = "D:d:e:G:g:I:Kk:m:N:p:R:r:Su:1:2:34:5:6:" \
 	getoptstring_COMMON;
 const struct option longopts[] = {
 	{ "respawn-delay",        1, NULL, 'D'},
@@ -88,6 +88,10 @@ const struct option longopts[] = {
 	{ "stdout",       1, NULL, '1'},
 	{ "stderr",       1, NULL, '2'},
 	{ "reexec",       0, NULL, '3'},
+	{ "cgroup",       1, NULL, '4'},
+	{ "cgroup-settings",1, NULL, 'G'},
+	{ "notify",       1, NULL, '5'},
+	{ "notify-timeout",1, NULL, '6'},
 	longopts_COMMON
 };
 const char * const longopts_help[] = {
@@ -109,6 +113,10 @@ const char * const longopts_help[] = {
 	"Redirect stdout to file",
 	"Redirect stderr to file",
 	"reexec (used internally)",
+	"Start the daemon in this cgroup2 directory",
+	"Settings to write to the cgroup, one \"file value\" per line",
+	"Wait for the daemon to signal readiness on fd:N or socket",
+	"Seconds to wait for readiness",
 	longopts_help_COMMON
 };
 const char *usagestring = NULL;
@@ -136,6 +144,10 @@ static int respawn_max = 10;
 static int respawn_period = 5;
 static char *pidfile = NULL;
 static char *svcname = NULL;
+static char *cgroup = NULL;
+static char *cgroup_settings = NULL;
+static int cgroup_fd = -1;
+static struct notify notify = { NOTIFY_NONE, -1, -1, -1, NULL, NULL, 0 };
 
 extern char **environ;
 
@@ -406,8 +418,8 @@ static void child_process(char *exec, char **argv)
 	if (redirect_stderr || rc_yesno(getenv("EINFO_QUIET")))
 		dup2(stderr_fd, STDERR_FILENO);
 
-	for (i = getdtablesize() - 1; i >= 3; --i)
-		fcntl(i, F_SETFD, FD_CLOEXEC);
+	close_fds(3, -1, true);
+	rc_notify_child(&notify);
 	cmdline = make_cmdline(argv);
 	syslog(LOG_INFO, "Child command line: %s", cmdline);
 	free(cmdline);
@@ -420,6 +432,44 @@ static void child_process(char *exec, char **argv)
 	eerrorx("%s: failed to exec `%s': %s", applet, exec,strerror(errno));
 }
 
+/*
+ * openrc-run.sh, or openrc-run, starts us inside the group we look after.
+ * Step out into its parent, so that the group empties once the daemon is
+ * gone and cgroup.kill does not take us with it.
+ * Returns false if we are still inside.
+ */
+static bool leave_cgroup(const char *dir)
+{
+	FILE *fp;
+	char *file;
+	const char *p;
+	pid_t pid, self = getpid();
+	bool inside = false;
+	int fd;
+
+	xasprintf(&file, "%s/cgroup.procs", dir);
+	if ((fp = fopen(file, "re"))) {
+		while (fscanf(fp, "%d", &pid) == 1)
+			if (pid == self)
+				inside = true;
+		fclose(fp);
+	}
+	free(file);
+	if (!inside)
+		return true;
+
+	if (!(p = strrchr(dir, '/')) || p == dir)
+		return false;
+	xasprintf(&file, "%.*s/cgroup.procs", (int)(p - dir), dir);
+	fd = open(file, O_WRONLY | O_CLOEXEC);
+	free(file);
+	if (fd == -1)
+		return false;
+	inside = write(fd, "0", 1) != 1;
+	close(fd);
+	return !inside;
+}
+
 static void supervisor(char *exec, char **argv)
 {
 	FILE *fp;
@@ -427,6 +477,7 @@ static void supervisor(char *exec, char **argv)
 	int nkilled;
 	time_t respawn_now= 0;
 	time_t first_spawn= 0;
+	const char *stop_cgroup = cgroup;
 
 #ifndef RC_DEBUG
 	signal_setup_restart(SIGHUP, handle_signal);
@@ -483,6 +534,12 @@ static void supervisor(char *exec, char **argv)
 	close(tty_fd);
 #endif
 
+	if (cgroup && !leave_cgroup(cgroup)) {
+		syslog(LOG_WARNING, "unable to leave %s, will only stop pid %d",
+		    cgroup, child_pid);
+		stop_cgroup = NULL;
+	}
+
 	/*
 	 * Supervisor main loop
 	 */
@@ -493,7 +550,7 @@ static void supervisor(char *exec, char **argv)
 			signal_setup(SIGCHLD, SIG_IGN);
 			syslog(LOG_INFO, "stopping %s, pid %d", exec, child_pid);
 			nkilled = run_stop_schedule(applet, exec, NULL, child_pid, 0,
-					false, false, true);
+					stop_cgroup, false, false, true);
 			if (nkilled > 0)
 				syslog(LOG_INFO, "killed %d processes", nkilled);
 		} else {
@@ -520,7 +577,7 @@ static void supervisor(char *exec, char **argv)
 			else if (WIFSIGNALED(i))
 				syslog(LOG_WARNING, "%s, pid %d, terminated by signal %d",
 						exec, child_pid, WTERMSIG(i));
-			child_pid = fork();
+			child_pid = rc_cgroup_fork(cgroup_fd);
 			if (child_pid == -1)
 				eerrorx("%s: fork: %s", applet, strerror(errno));
 			if (child_pid == 0)
@@ -566,6 +623,7 @@ int main(int argc, char **argv)
 	FILE *fp;
 	mode_t numask = 022;
 	int child_argc = 0;
+	int notify_timeout = RC_NOTIFY_TIMEOUT;
 	char **child_argv = NULL;
 	char *str = NULL;
 	char *cmdline = NULL;
@@ -739,6 +797,27 @@ int main(int argc, char **argv)
 			reexec = true;
 			break;
 
+		case '4':  /* --cgroup <directory> */
+			cgroup = optarg;
+			break;
+
+		case 'G':  /* --cgroup-settings <settings> */
+			cgroup_settings = optarg;
+			break;
+
+		case '5':  /* --notify fd:N|socket */
+			if (!rc_notify_parse(&notify, optarg))
+				eerrorx("%s: invalid notify type `%s'",
+				    applet, optarg);
+			break;
+
+		case '6':  /* --notify-timeout <seconds> */
+			if (sscanf(optarg, "%d", &notify_timeout) != 1 ||
+			    notify_timeout < 1)
+				eerrorx("%s: invalid notify timeout `%s'",
+				    applet, optarg);
+			break;
+
 		case_RC_COMMON_GETOPT
 		}
 
@@ -786,6 +865,8 @@ int main(int argc, char **argv)
 		sscanf(str, "%d", &respawn_delay);
 		str = rc_service_value_get(svcname, "respawn_max");
 		sscanf(str, "%d", &respawn_max);
+		if ((cgroup = rc_service_value_get(svcname, "cgroup")))
+			cgroup_fd = rc_cgroup_open(cgroup, NULL);
 		supervisor(exec, child_argv);
 	} else if (start) {
 		if (exec) {
@@ -856,7 +937,16 @@ int main(int argc, char **argv)
 			eerrorx("%s: fopen `%s': %s", applet, pidfile, strerror(errno));
 		fclose(fp);
 
+		if (cgroup &&
+		    (cgroup_fd = rc_cgroup_open(cgroup, cgroup_settings)) == -1)
+			eerrorx("%s: %s: %s", applet, cgroup, strerror(errno));
+
+		if (!rc_notify_open(&notify, uid ? uid : geteuid()))
+			eerrorx("%s: unable to set up notification: %s",
+			    applet, strerror(errno));
+
 		rc_service_value_set(svcname, "pidfile", pidfile);
+		rc_service_value_set(svcname, "cgroup", cgroup);
 		varbuf = NULL;
 		xasprintf(&varbuf, "%i", respawn_delay);
 		rc_service_value_set(svcname, "respawn_delay", varbuf);
@@ -870,9 +960,20 @@ int main(int argc, char **argv)
 		child_pid = fork();
 		if (child_pid == -1)
 			eerrorx("%s: fork: %s", applet, strerror(errno));
-		if (child_pid != 0)
-			/* first parent process, do nothing. */
-			exit(EXIT_SUCCESS);
+		if (child_pid != 0) {
+			/* first parent process, wait for the daemon to be
+			 * ready if it can tell us, otherwise do nothing. */
+			i = rc_notify_wait(&notify, notify_timeout * 1000, 0);
+			rc_notify_close(&notify);
+			if (i == 1)
+				exit(EXIT_SUCCESS);
+			kill(child_pid, SIGTERM);
+			if (i == 0)
+				eerrorx("%s: %s did not signal readiness within"
+				    " %d seconds", applet, exec, notify_timeout);
+			eerrorx("%s: %s died before signalling readiness",
+			    applet, exec);
+		}
 #ifdef TIOCNOTTY
 		tty_fd = open("/dev/tty", O_RDWR);
 #endif
@@ -880,10 +981,13 @@ int main(int argc, char **argv)
 		dup2(devnull_fd, 0);
 		dup2(devnull_fd, 1);
 		dup2(devnull_fd, 2);
-		child_pid = fork();
+		child_pid = rc_cgroup_fork(cgroup_fd);
 		if (child_pid == -1)
 			eerrorx("%s: fork: %s", applet, strerror(errno));
 		else if (child_pid != 0) {
+			/* Only the first child reports to the first parent */
+			rc_notify_close(&notify);
+			notify.type = NOTIFY_NONE;
 			c = argv;
 			x = 0;
 			while (c && *c) {